@@ -0,0 +1,178 @@
+#include "checkpoint.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+
+
+namespace {
+
+uint64_t Align(uint64_t offset) {
+  return (offset + kCheckpointAlignment - 1) / kCheckpointAlignment * kCheckpointAlignment;
+}
+
+// Lays out the sections after the header and fills in their offsets.
+void PlaceSections(CheckpointHeader* header) {
+  uint64_t offset = Align(sizeof(CheckpointHeader));
+  header->small_groups_offset = offset;
+  offset = Align(offset + 3 * sizeof(double) * header->num_small_groups);
+  header->big_groups_offset = offset;
+  offset = Align(offset + 3 * sizeof(double) * header->num_big_groups);
+  header->big_class_positions_offset = offset;
+  if (header->num_big_class_positions > 0) {
+    offset = Align(offset + sizeof(int32_t) * header->num_big_class_positions);
+  }
+  int64_t num_classes = header->num_bounded_classes;
+  header->class_bounds_offset = offset;
+  offset = Align(offset + sizeof(double) * num_classes * num_classes);
+  header->class_rates_offset = offset;
+  offset = Align(offset + sizeof(double) * num_classes);
+  header->rng_offset = offset;
+  header->file_size = offset + header->rng_size;
+}
+
+// Empty vectors may hold a null pointer, which memcpy must not be given
+// even for zero bytes.
+void WriteDoubles(const std::vector<double>& values, char* out) {
+  if (!values.empty()) {
+    std::memcpy(out, values.data(), sizeof(double) * values.size());
+  }
+}
+
+void WriteGroups(const ParticleGroups& groups, char* out) {
+  size_t size = sizeof(double) * groups.Size();
+  WriteDoubles(groups.counts, out);
+  WriteDoubles(groups.sizes, out + size);
+  WriteDoubles(groups.collision_rates, out + 2 * size);
+}
+
+void ReadGroups(const char* in, int64_t num_groups, ParticleGroups* groups) {
+  const double* values = reinterpret_cast<const double*>(in);
+  groups->counts.assign(values, values + num_groups);
+  groups->sizes.assign(values + num_groups, values + 2 * num_groups);
+  groups->collision_rates.assign(values + 2 * num_groups, values + 3 * num_groups);
+}
+
+} // namespace
+
+
+bool WriteCheckpoint(const SimulationState& state, double simulation_time,
+                     std::chrono::nanoseconds elapsed_time, const std::string& path) {
+  CheckpointHeader header{};
+  std::memcpy(header.magic, kCheckpointMagic, sizeof(header.magic));
+  header.version = kCheckpointVersion;
+  header.header_size = sizeof(CheckpointHeader);
+  header.simulation_time = simulation_time;
+  header.elapsed_ns = elapsed_time.count();
+  header.pair_selection = static_cast<int32_t>(state.pair_selection);
+  header.fragmentation_rate = state.fragmentation_rate;
+  header.step_counter = state.step_counter;
+  header.rate_tree_capacity = state.rate_tree_capacity;
+  header.total_rate = state.total_rate;
+  header.cell_size = state.cell_size;
+  header.num_particles = state.num_particles;
+  header.num_initial_particles = state.num_initial_particles;
+  header.max_num_particles = state.max_num_particles;
+  header.total_size = state.total_size;
+  header.num_bounded_classes = state.num_bounded_classes;
+  header.factor_tree_capacity = state.factor_tree_capacity;
+  header.num_small_groups = state.small_groups.Size();
+  header.num_big_groups = state.big_groups.Size();
+  header.num_big_class_positions = state.big_class_positions.size();
+  header.rng_size = state.rng.size();
+  PlaceSections(&header);
+
+  std::string contents(header.file_size, '\0');
+  char* data = contents.data();
+  std::memcpy(data, &header, sizeof(header));
+  WriteGroups(state.small_groups, data + header.small_groups_offset);
+  WriteGroups(state.big_groups, data + header.big_groups_offset);
+  for (size_t slot = 0; slot < state.big_class_positions.size(); slot++) {
+    int32_t position = state.big_class_positions[slot];
+    std::memcpy(data + header.big_class_positions_offset + slot * sizeof(int32_t), &position,
+                sizeof(int32_t));
+  }
+  WriteDoubles(state.class_bounds, data + header.class_bounds_offset);
+  WriteDoubles(state.class_rates, data + header.class_rates_offset);
+  std::memcpy(data + header.rng_offset, state.rng.data(), state.rng.size());
+
+  std::ofstream out(path, std::ios::out | std::ios::binary);
+  out.write(data, contents.size());
+  return bool(out);
+}
+
+
+bool ReadCheckpoint(const std::string& path, SimulationState* state, double* simulation_time,
+                    std::chrono::nanoseconds* elapsed_time) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size < off_t(sizeof(CheckpointHeader))) {
+    close(fd);
+    return false;
+  }
+  void* mapping = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+  const char* data = static_cast<const char*>(mapping);
+
+  CheckpointHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  bool is_valid = std::memcmp(header.magic, kCheckpointMagic, sizeof(header.magic)) == 0 &&
+                  header.version == kCheckpointVersion &&
+                  header.header_size == sizeof(CheckpointHeader) &&
+                  header.file_size == uint64_t(file_stat.st_size) &&
+                  (header.num_big_class_positions == 0 ||
+                   header.num_big_class_positions == header.num_big_groups);
+  if (is_valid) {
+    // The offsets are recomputed rather than trusted.
+    CheckpointHeader expected = header;
+    PlaceSections(&expected);
+    is_valid = std::memcmp(&expected, &header, sizeof(header)) == 0;
+  }
+  if (!is_valid) {
+    munmap(mapping, file_stat.st_size);
+    return false;
+  }
+
+  *simulation_time = header.simulation_time;
+  *elapsed_time = std::chrono::nanoseconds(header.elapsed_ns);
+  state->pair_selection = static_cast<PairSelection>(header.pair_selection);
+  state->fragmentation_rate = header.fragmentation_rate;
+  state->step_counter = header.step_counter;
+  state->rate_tree_capacity = header.rate_tree_capacity;
+  state->total_rate = header.total_rate;
+  state->cell_size = header.cell_size;
+  state->num_particles = header.num_particles;
+  state->num_initial_particles = header.num_initial_particles;
+  state->max_num_particles = header.max_num_particles;
+  state->total_size = header.total_size;
+  state->num_bounded_classes = header.num_bounded_classes;
+  state->factor_tree_capacity = header.factor_tree_capacity;
+
+  ReadGroups(data + header.small_groups_offset, header.num_small_groups, &state->small_groups);
+  ReadGroups(data + header.big_groups_offset, header.num_big_groups, &state->big_groups);
+  state->big_class_positions.clear();
+  if (header.num_big_class_positions > 0) {
+    const int32_t* positions =
+        reinterpret_cast<const int32_t*>(data + header.big_class_positions_offset);
+    state->big_class_positions.assign(positions, positions + header.num_big_class_positions);
+  }
+  int64_t num_classes = header.num_bounded_classes;
+  const double* class_bounds = reinterpret_cast<const double*>(data + header.class_bounds_offset);
+  state->class_bounds.assign(class_bounds, class_bounds + num_classes * num_classes);
+  const double* class_rates = reinterpret_cast<const double*>(data + header.class_rates_offset);
+  state->class_rates.assign(class_rates, class_rates + num_classes);
+  state->rng.assign(data + header.rng_offset, header.rng_size);
+
+  munmap(mapping, file_stat.st_size);
+  return true;
+}
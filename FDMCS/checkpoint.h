@@ -0,0 +1,67 @@
+#ifndef FDMCS_CHECKPOINT
+#define FDMCS_CHECKPOINT
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "simulation.h"
+
+inline constexpr char kCheckpointMagic[8] = "FDMCSCK";
+inline constexpr uint32_t kCheckpointVersion = 1;
+// Every section starts at a multiple of this, so that a mapped file can be
+// read in place.
+inline constexpr uint64_t kCheckpointAlignment = 64;
+
+// Binary checkpoint holding a full SimulationState.
+//
+// The file starts with this header. Sections follow at the given byte
+// offsets: small and big groups as counts, sizes and collision rates, each a
+// packed array of doubles, then the int32 size-class positions of big
+// particles if the state has them, the majorant class bounds and rates as
+// doubles, and the text form of the random engine. All numbers are stored in
+// the byte order of the host.
+struct CheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  double simulation_time;
+  int64_t elapsed_ns;
+
+  int32_t pair_selection;
+  float fragmentation_rate;
+  int32_t step_counter;
+  int32_t rate_tree_capacity;
+  double total_rate;
+  double cell_size;
+  int64_t num_particles;
+  int64_t num_initial_particles;
+  int64_t max_num_particles;
+  int64_t total_size;
+  int32_t num_bounded_classes;
+  int32_t factor_tree_capacity;
+
+  int64_t num_small_groups;
+  int64_t num_big_groups;
+  uint64_t rng_size;
+  uint64_t small_groups_offset;
+  uint64_t big_groups_offset;
+  uint64_t big_class_positions_offset;
+  uint64_t class_bounds_offset;
+  uint64_t class_rates_offset;
+  uint64_t rng_offset;
+  uint64_t file_size;
+  // Either 0 or num_big_groups.
+  int64_t num_big_class_positions;
+};
+
+// Writes `state` to `path`. Returns false if the file could not be written.
+bool WriteCheckpoint(const SimulationState& state, double simulation_time,
+                     std::chrono::nanoseconds elapsed_time, const std::string& path);
+
+// Reads a checkpoint written by WriteCheckpoint. Returns false if the file
+// cannot be read or is not a checkpoint of a supported version.
+bool ReadCheckpoint(const std::string& path, SimulationState* state, double* simulation_time,
+                    std::chrono::nanoseconds* elapsed_time);
+
+#endif
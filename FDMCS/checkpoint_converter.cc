@@ -0,0 +1,29 @@
+#include "FDMCS/simulation.pb.h"
+#include "FDMCS/simulation.h"
+#include "FDMCS/io_util.h"
+#include "FDMCS/simulation_config.h"
+
+#include <google/protobuf/util/json_util.h>
+#include <iostream>
+
+using ::google::protobuf::util::JsonStringToMessage;
+
+
+// Converts text checkpoints (.cpt) into binary checkpoints. The config
+// supplies the kernel and pair selection used to recompute collision rates.
+int main(int argc, char const *argv[]) {
+  if (argc != 4) {
+    std::cerr << "Usage: " << argv[0] << " <config> <input.cpt> <output.ckpt>" << std::endl;
+    exit(2);
+  }
+
+  SimulationConfiguration config;
+  JsonStringToMessage(GetFileContents(argv[1]), &config);
+
+  std::unique_ptr<Simulation> simulation = ConstructEmptySimulation(config);
+  if (!ConvertTextCheckpoint(*simulation, argv[2], argv[3])) {
+    std::cerr << "Cannot write checkpoint " << argv[3] << std::endl;
+    exit(1);
+  }
+  return 0;
+}
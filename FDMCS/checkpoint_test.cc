@@ -0,0 +1,111 @@
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <fstream>
+
+#include "gtest/gtest.h"
+
+
+TEST(CheckpointTest, RoundTripKeepsState) {
+  BrownianKernelSimulation simulation(/*fragmentation_rate=*/0.2, std::mt19937(7), /*alpha=*/0.5);
+  simulation.SetPairSelection(PairSelection::kMajorant);
+  simulation.AddMonomers(100);
+  simulation.AddParticle(12000);
+  simulation.AddParticle(20000);
+  simulation.AddParticle(13000);
+  simulation.DeleteParticle(kNumSmallParticles);
+  for (int i = 0; i < 20; i++) {
+    simulation.RunSimulationStep();
+  }
+  SimulationState state;
+  simulation.SaveState(&state);
+
+  std::string path = testing::TempDir() + "/round_trip.ckpt";
+  ASSERT_TRUE(WriteCheckpoint(state, 1.5, std::chrono::nanoseconds(42), path));
+
+  SimulationState loaded;
+  double simulation_time;
+  std::chrono::nanoseconds elapsed_time;
+  ASSERT_TRUE(ReadCheckpoint(path, &loaded, &simulation_time, &elapsed_time));
+  EXPECT_EQ(simulation_time, 1.5);
+  EXPECT_EQ(elapsed_time.count(), 42);
+  EXPECT_EQ(loaded.pair_selection, state.pair_selection);
+  EXPECT_EQ(loaded.step_counter, state.step_counter);
+  EXPECT_EQ(loaded.total_rate, state.total_rate);
+  EXPECT_EQ(loaded.num_particles, state.num_particles);
+  EXPECT_EQ(loaded.total_size, state.total_size);
+  EXPECT_EQ(loaded.small_groups.counts, state.small_groups.counts);
+  EXPECT_EQ(loaded.small_groups.collision_rates, state.small_groups.collision_rates);
+  EXPECT_EQ(loaded.big_groups.sizes, state.big_groups.sizes);
+  EXPECT_EQ(loaded.big_class_positions, state.big_class_positions);
+  EXPECT_EQ(loaded.class_bounds, state.class_bounds);
+  EXPECT_EQ(loaded.class_rates, state.class_rates);
+  EXPECT_EQ(loaded.rng, state.rng);
+  std::remove(path.c_str());
+}
+
+// Writes and reads back the state of `simulation`, then checks that a
+// simulation restored from the file takes the same steps.
+void ExpectResumedStepsMatch(ConstantKernelSimulation& simulation, SecondSampler second_sampler) {
+  SimulationState state;
+  simulation.SaveState(&state);
+  std::string path = testing::TempDir() + "/resume.ckpt";
+  ASSERT_TRUE(WriteCheckpoint(state, 1.0, std::chrono::nanoseconds(0), path));
+
+  SimulationState loaded;
+  double simulation_time;
+  std::chrono::nanoseconds elapsed_time;
+  ASSERT_TRUE(ReadCheckpoint(path, &loaded, &simulation_time, &elapsed_time));
+  std::remove(path.c_str());
+  EXPECT_EQ(loaded.big_class_positions, state.big_class_positions);
+
+  ConstantKernelSimulation restored(/*fragmentation_rate=*/0, std::mt19937());
+  restored.SetSecondSampler(second_sampler);
+  restored.RestoreState(loaded);
+  for (int i = 0; i < 200; i++) {
+    ASSERT_EQ(restored.RunSimulationStep(), simulation.RunSimulationStep());
+  }
+  std::vector<Particle> expected = simulation.GetDistribution();
+  std::vector<Particle> actual = restored.GetDistribution();
+  ASSERT_EQ(actual.size(), expected.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    EXPECT_EQ(actual[i].count, expected[i].count);
+    EXPECT_EQ(actual[i].size, expected[i].size);
+  }
+}
+
+TEST(CheckpointTest, ResumesExactSizeClassPartnersAfterBigGroupRemoval) {
+  ConstantKernelSimulation simulation(/*fragmentation_rate=*/0.2, std::mt19937(3));
+  simulation.SetSecondSampler(SecondSampler::kSizeClasses);
+  simulation.AddMonomers(200);
+  for (long long size : {12000, 13000, 15000, 40000}) {
+    simulation.AddParticle(size);
+  }
+  simulation.DeleteParticle(kNumSmallParticles);
+  ExpectResumedStepsMatch(simulation, SecondSampler::kSizeClasses);
+}
+
+TEST(CheckpointTest, StoresClassPositionsOfManyBigGroups) {
+  ConstantKernelSimulation simulation(/*fragmentation_rate=*/0.2, std::mt19937(5));
+  simulation.SetSecondSampler(SecondSampler::kSizeClasses);
+  simulation.AddMonomers(100);
+  for (long long size = 10000; size < 15000; size++) {
+    simulation.AddParticle(size);
+  }
+  ExpectResumedStepsMatch(simulation, SecondSampler::kSizeClasses);
+}
+
+TEST(CheckpointTest, RejectsOtherFiles) {
+  std::string path = testing::TempDir() + "/text.cpt";
+  {
+    std::ofstream out(path);
+    out << "12345" << std::endl << "1 10 9" << std::endl;
+  }
+
+  SimulationState state;
+  double simulation_time;
+  std::chrono::nanoseconds elapsed_time;
+  EXPECT_FALSE(ReadCheckpoint(path, &state, &simulation_time, &elapsed_time));
+  EXPECT_FALSE(ReadCheckpoint(path + ".missing", &state, &simulation_time, &elapsed_time));
+  std::remove(path.c_str());
+}
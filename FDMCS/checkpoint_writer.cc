@@ -0,0 +1,88 @@
+#include "checkpoint_writer.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "checkpoint.h"
+
+
+CheckpointWriter::CheckpointWriter(int capacity)
+    : capacity_(std::max(capacity, 1)), closed_(false) {
+  thread_ = std::thread(&CheckpointWriter::Run, this);
+}
+
+
+CheckpointWriter::~CheckpointWriter() {
+  Close();
+}
+
+
+void CheckpointWriter::Save(const Simulation& simulation, double simulation_time,
+                            std::chrono::nanoseconds elapsed_time, const std::string& path) {
+  std::unique_ptr<Snapshot> snapshot;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this] { return int(pending_.size()) < capacity_; });
+    if (!free_.empty()) {
+      snapshot = std::move(free_.back());
+      free_.pop_back();
+    }
+  }
+  if (!snapshot) {
+    snapshot = std::make_unique<Snapshot>();
+  }
+
+  // The copy happens outside of the lock, so the writer keeps going.
+  simulation.SaveState(&snapshot->state);
+  snapshot->simulation_time = simulation_time;
+  snapshot->elapsed_time = elapsed_time;
+  snapshot->path = path;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.push_back(std::move(snapshot));
+  }
+  changed_.notify_all();
+}
+
+
+void CheckpointWriter::Close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_) {
+      return;
+    }
+    closed_ = true;
+  }
+  changed_.notify_all();
+  thread_.join();
+}
+
+
+void CheckpointWriter::Run() {
+  while (true) {
+    std::unique_ptr<Snapshot> snapshot;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      changed_.wait(lock, [this] { return closed_ || !pending_.empty(); });
+      if (pending_.empty()) {
+        return;
+      }
+      snapshot = std::move(pending_.front());
+    }
+
+    if (!WriteCheckpoint(snapshot->state, snapshot->simulation_time, snapshot->elapsed_time,
+                         snapshot->path)) {
+      std::cerr << "Cannot write checkpoint " << snapshot->path << std::endl;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      // The snapshot leaves the queue only once it is written, so that it
+      // counts against the capacity while being written.
+      pending_.pop_front();
+      free_.push_back(std::move(snapshot));
+    }
+    changed_.notify_all();
+  }
+}
@@ -0,0 +1,56 @@
+#ifndef FDMCS_CHECKPOINT_WRITER
+#define FDMCS_CHECKPOINT_WRITER
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "simulation.h"
+
+// Writes checkpoints on a background thread.
+//
+// Save copies the simulation state into a snapshot and returns without
+// waiting for I/O. At most `capacity` snapshots wait to be written; once the
+// queue is full Save blocks until the writer catches up. Snapshots are
+// reused between checkpoints, so steady-state saves do not allocate. Close
+// and the destructor write all pending snapshots before returning. Save
+// must not be called after Close.
+class CheckpointWriter {
+ public:
+  explicit CheckpointWriter(int capacity);
+  ~CheckpointWriter();
+
+  CheckpointWriter(const CheckpointWriter&) = delete;
+  CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+  void Save(const Simulation& simulation, double simulation_time,
+            std::chrono::nanoseconds elapsed_time, const std::string& path);
+
+  // Waits until all pending snapshots are written and stops the thread.
+  void Close();
+
+ private:
+  struct Snapshot {
+    SimulationState state;
+    double simulation_time;
+    std::chrono::nanoseconds elapsed_time;
+    std::string path;
+  };
+
+  void Run();
+
+  int capacity_;
+  bool closed_;
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::deque<std::unique_ptr<Snapshot>> pending_;
+  std::vector<std::unique_ptr<Snapshot>> free_;
+  std::thread thread_;
+};
+
+#endif
@@ -0,0 +1,38 @@
+#include "checkpoint_writer.h"
+
+#include <cstdio>
+
+#include "checkpoint.h"
+#include "gtest/gtest.h"
+
+
+TEST(CheckpointWriterTest, WritesAllSnapshotsOnClose) {
+  ConstantKernelSimulation simulation(/*fragmentation_rate=*/0.5, std::mt19937());
+  simulation.AddMonomers(200);
+
+  std::vector<std::string> paths;
+  std::vector<long long> num_particles;
+  CheckpointWriter writer(/*capacity=*/1);
+  for (int i = 0; i < 5; i++) {
+    for (int step = 0; step < 10; step++) {
+      simulation.RunSimulationStep();
+    }
+    paths.push_back(testing::TempDir() + "/writer_" + std::to_string(i) + ".ckpt");
+    SimulationState state;
+    simulation.SaveState(&state);
+    num_particles.push_back(state.num_particles);
+    writer.Save(simulation, i, std::chrono::nanoseconds(i), paths.back());
+  }
+  writer.Close();
+
+  for (int i = 0; i < int(paths.size()); i++) {
+    SimulationState state;
+    double simulation_time;
+    std::chrono::nanoseconds elapsed_time;
+    ASSERT_TRUE(ReadCheckpoint(paths[i], &state, &simulation_time, &elapsed_time));
+    EXPECT_EQ(simulation_time, i);
+    EXPECT_EQ(elapsed_time.count(), i);
+    EXPECT_EQ(state.num_particles, num_particles[i]);
+    std::remove(paths[i].c_str());
+  }
+}
@@ -0,0 +1,126 @@
+#include "ensemble.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+
+namespace {
+
+// Normal quantile of the two-sided 95% confidence interval.
+constexpr double kConfidenceQuantile = 1.96;
+
+} // namespace
+
+
+std::vector<double> Observe(Simulation& simulation, int spectrum_sizes) {
+  std::vector<double> values(kSpectrum + spectrum_sizes, 0.0);
+  double mass = 0;
+  for (const auto& particle : simulation.GetDistribution()) {
+    double count = particle.count;
+    double size = particle.size;
+    mass += count * size;
+    values[kZerothMoment] += count;
+    values[kSecondMoment] += count * size * size;
+    if (particle.size == 1) {
+      values[kMonomerFraction] = count;
+    }
+    if (particle.size <= spectrum_sizes) {
+      values[kSpectrum + particle.size - 1] = count;
+    }
+  }
+  if (mass > 0) {
+    for (double& value : values) {
+      value /= mass;
+    }
+  }
+  return values;
+}
+
+
+EnsembleStatistics::EnsembleStatistics(int num_checkpoints, int spectrum_sizes)
+    : num_values_(kSpectrum + spectrum_sizes),
+      counts_(num_checkpoints, 0),
+      means_(num_checkpoints * num_values_, 0.0),
+      squared_deviations_(num_checkpoints * num_values_, 0.0) {}
+
+
+void EnsembleStatistics::Add(int checkpoint, const std::vector<double>& values) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int count = ++counts_[checkpoint];
+  double* means = means_.data() + checkpoint * num_values_;
+  double* squared_deviations = squared_deviations_.data() + checkpoint * num_values_;
+  for (int i = 0; i < num_values_; i++) {
+    double delta = values[i] - means[i];
+    means[i] += delta / count;
+    squared_deviations[i] += delta * (values[i] - means[i]);
+  }
+}
+
+
+int EnsembleStatistics::NumReplicas(int checkpoint) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return counts_[checkpoint];
+}
+
+
+double EnsembleStatistics::Mean(int checkpoint, int observable) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return means_[checkpoint * num_values_ + observable];
+}
+
+
+double EnsembleStatistics::StandardError(int checkpoint, int observable) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int count = counts_[checkpoint];
+  if (count < 2) {
+    return 0;
+  }
+  double variance = squared_deviations_[checkpoint * num_values_ + observable] / (count - 1);
+  return std::sqrt(variance / count);
+}
+
+
+double EnsembleStatistics::MaxRelativeError(const std::vector<int>& observables) const {
+  double max_error = 0;
+  for (int checkpoint = 0; checkpoint < int(counts_.size()); checkpoint++) {
+    if (NumReplicas(checkpoint) == 0) {
+      continue;
+    }
+    for (int observable : observables) {
+      double error = StandardError(checkpoint, observable);
+      double mean = std::abs(Mean(checkpoint, observable));
+      if (error > 0) {
+        max_error = std::max(max_error, mean > 0 ? error / mean
+                                                 : std::numeric_limits<double>::infinity());
+      }
+    }
+  }
+  return max_error;
+}
+
+
+void EnsembleStatistics::WriteJson(double interval, std::ostream& out) const {
+  auto write_value = [&](int checkpoint, int observable) {
+    out << "[" << Mean(checkpoint, observable) << ", "
+        << kConfidenceQuantile * StandardError(checkpoint, observable) << "]";
+  };
+  for (int checkpoint = 0; checkpoint < int(counts_.size()); checkpoint++) {
+    if (NumReplicas(checkpoint) == 0) {
+      continue;
+    }
+    out << "{\"simulation_time\": " << checkpoint * interval
+        << ", \"replicas\": " << NumReplicas(checkpoint) << ", \"zeroth_moment\": ";
+    write_value(checkpoint, kZerothMoment);
+    out << ", \"second_moment\": ";
+    write_value(checkpoint, kSecondMoment);
+    out << ", \"monomer_fraction\": ";
+    write_value(checkpoint, kMonomerFraction);
+    out << ", \"spectrum\": [";
+    for (int i = kSpectrum; i < num_values_; i++) {
+      out << (i > kSpectrum ? ", " : "");
+      write_value(checkpoint, i);
+    }
+    out << "]}\n";
+  }
+}
@@ -0,0 +1,60 @@
+#ifndef FDMCS_ENSEMBLE
+#define FDMCS_ENSEMBLE
+
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "simulation.h"
+
+// Observables of a single state, in terms of concentrations normalized by
+// the total mass, c_k = n_k / sum_j j * n_j. The first moment is 1 by
+// construction and therefore not tracked.
+enum Observable {
+  kZerothMoment,
+  kSecondMoment,
+  // c_1, the mass fraction of monomers.
+  kMonomerFraction,
+  // c_1, ..., c_{spectrum_sizes}.
+  kSpectrum,
+};
+
+// Values of all observables, the spectrum starting at index kSpectrum.
+std::vector<double> Observe(Simulation& simulation, int spectrum_sizes);
+
+// Means and variances of the observables over the replicas of an ensemble,
+// for every checkpoint. Replicas are merged online with Welford's update as
+// they reach a checkpoint, so no per-replica data is kept. Add may be
+// called concurrently.
+class EnsembleStatistics {
+ public:
+  EnsembleStatistics(int num_checkpoints, int spectrum_sizes);
+
+  void Add(int checkpoint, const std::vector<double>& values);
+
+  int NumReplicas(int checkpoint) const;
+  double Mean(int checkpoint, int observable) const;
+  // Standard error of the mean, 0 for fewer than two replicas.
+  double StandardError(int checkpoint, int observable) const;
+
+  // Largest standard error relative to the mean of the given observables
+  // over all checkpoints with replicas. Infinite if a mean is zero while
+  // its standard error is not.
+  double MaxRelativeError(const std::vector<int>& observables) const;
+
+  // One line per checkpoint with replicas, taken at `interval` time units
+  // apart. Every observable is written as [mean, half width of the 95%
+  // confidence interval].
+  void WriteJson(double interval, std::ostream& out) const;
+
+ private:
+  int num_values_;
+  mutable std::mutex mutex_;
+  std::vector<int> counts_;
+  // Row-major num_checkpoints x num_values_.
+  std::vector<double> means_;
+  std::vector<double> squared_deviations_;
+};
+
+#endif
@@ -0,0 +1,77 @@
+#include "ensemble.h"
+
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+
+TEST(EnsembleTest, ObserveNormalizesByMass) {
+  ConstantKernelSimulation simulation(/*fragmentation_rate=*/0, std::mt19937());
+  simulation.AddParticles(1, 6);
+  simulation.AddParticles(2, 2);
+  simulation.AddParticle(12000);
+
+  std::vector<double> values = Observe(simulation, /*spectrum_sizes=*/3);
+  double mass = 6 + 4 + 12000;
+  ASSERT_EQ(values.size(), kSpectrum + 3);
+  EXPECT_DOUBLE_EQ(values[kZerothMoment], 9 / mass);
+  EXPECT_DOUBLE_EQ(values[kSecondMoment], (6 + 8 + 12000.0 * 12000) / mass);
+  EXPECT_DOUBLE_EQ(values[kMonomerFraction], 6 / mass);
+  EXPECT_DOUBLE_EQ(values[kSpectrum], 6 / mass);
+  EXPECT_DOUBLE_EQ(values[kSpectrum + 1], 2 / mass);
+  EXPECT_EQ(values[kSpectrum + 2], 0);
+}
+
+TEST(EnsembleTest, StatisticsMatchSampleMeanAndError) {
+  EnsembleStatistics statistics(/*num_checkpoints=*/2, /*spectrum_sizes=*/0);
+  for (double value : {1.0, 2.0, 4.0, 5.0}) {
+    statistics.Add(1, {value, 2 * value, 0});
+  }
+
+  EXPECT_EQ(statistics.NumReplicas(0), 0);
+  EXPECT_EQ(statistics.NumReplicas(1), 4);
+  EXPECT_DOUBLE_EQ(statistics.Mean(1, kZerothMoment), 3);
+  EXPECT_DOUBLE_EQ(statistics.Mean(1, kSecondMoment), 6);
+  // Sample variance 10 / 3.
+  EXPECT_DOUBLE_EQ(statistics.StandardError(1, kZerothMoment), std::sqrt(10.0 / 3 / 4));
+  EXPECT_EQ(statistics.StandardError(1, kMonomerFraction), 0);
+
+  std::ostringstream out;
+  statistics.WriteJson(/*interval=*/0.5, out);
+  EXPECT_EQ(out.str().substr(0, 48), "{\"simulation_time\": 0.5, \"replicas\": 4, \"zeroth_");
+}
+
+TEST(EnsembleTest, MaxRelativeErrorCoversAllCheckpoints) {
+  EnsembleStatistics statistics(/*num_checkpoints=*/3, /*spectrum_sizes=*/0);
+  for (double value : {1.0, 3.0}) {
+    statistics.Add(0, {1, 1, 1});
+    statistics.Add(1, {value, 10, 1});
+    statistics.Add(2, {2, 10 + value, 0});
+  }
+
+  // Standard errors are 1 for the varying values.
+  EXPECT_DOUBLE_EQ(statistics.MaxRelativeError({kZerothMoment}), 0.5);
+  EXPECT_DOUBLE_EQ(statistics.MaxRelativeError({kSecondMoment}), 1.0 / 12);
+  EXPECT_DOUBLE_EQ(statistics.MaxRelativeError({kSecondMoment, kZerothMoment}), 0.5);
+  EXPECT_EQ(statistics.MaxRelativeError({kMonomerFraction}), 0);
+}
+
+TEST(EnsembleTest, ConcurrentAddsAreMerged) {
+  EnsembleStatistics statistics(/*num_checkpoints=*/1, /*spectrum_sizes=*/1);
+  std::vector<std::thread> threads;
+  for (int thread = 0; thread < 4; thread++) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < 1000; i++) {
+        statistics.Add(0, {1, 1, 1, 1});
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(statistics.NumReplicas(0), 4000);
+  EXPECT_DOUBLE_EQ(statistics.Mean(0, kSpectrum), 1);
+}
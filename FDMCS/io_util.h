@@ -6,6 +6,7 @@
 #include <filesystem>
 #include <chrono>
 
+#include "checkpoint.h"
 #include "simulation.h"
 
 std::string GetFileContents(const std::string& filename)
@@ -32,41 +33,28 @@ void PrintParticles(const std::vector<Particle>& particles) {
 }
 
 
-void SaveCheckpoint(Simulation& simulation, std::string output_dir, float simulation_time, int checkpoint_num, std::chrono::nanoseconds elapsed_time) {
-  std::filesystem::create_directories(output_dir);
-
-  std::string filename = output_dir + "/" + std::to_string(simulation_time) + ".cpt";
-  std::cout << filename << std::endl;
-  std::ofstream out(filename, std::ios::out);
-  if (out) {
-    out << elapsed_time.count() << std::endl;
-    for (const auto& particle : simulation.GetDistribution()) {
-      out << particle.size << " " << particle.count << " " << particle.collision_rate << std::endl;
-    }
-    out.close();
-  } else {
-    std::cerr << "Error code: " << strerror(errno);
-  }
+std::string CheckpointPath(const std::string& output_dir, double simulation_time) {
+  return output_dir + "/" + std::to_string(simulation_time) + ".ckpt";
 }
 
-std::chrono::nanoseconds LoadCheckpoint(Simulation& simulation, std::string checkpoint_path) {
+
+// Loads the particles of a text checkpoint with `size count collision_rate`
+// lines, the format used before binary checkpoints. Collision rates are
+// recomputed.
+std::chrono::nanoseconds LoadTextCheckpoint(Simulation& simulation, std::string checkpoint_path) {
   long long duration;
   std::ifstream in(checkpoint_path);
   if (in) {
     in >> duration;
 
+    std::vector<Particle> particles;
     long long size;
     long long count;
     float collision_rate;
     while (in >> size >> count >> collision_rate) {
-      if (size == 1) {
-        simulation.AddMonomers(count);
-      } else {
-        for (long long i = 0; i < count; i++) {
-          simulation.AddParticle(size);
-        }
-      }
+      particles.push_back(Particle{count, size, 0});
     }
+    simulation.AddParticles(particles);
     in.close();
   } else {
     std::cerr << "Error code: " << strerror(errno);
@@ -74,4 +62,34 @@ std::chrono::nanoseconds LoadCheckpoint(Simulation& simulation, std::string chec
   return std::chrono::nanoseconds(duration);
 }
 
+// Restores a checkpoint written by WriteCheckpoint. Text checkpoints with the
+// .cpt extension are loaded with LoadTextCheckpoint and take their time from
+// the file name.
+std::chrono::nanoseconds LoadCheckpoint(Simulation& simulation, std::string checkpoint_path, double* simulation_time) {
+  std::filesystem::path path(checkpoint_path);
+  if (path.extension() == ".cpt") {
+    *simulation_time = std::stod(path.stem().string());
+    return LoadTextCheckpoint(simulation, checkpoint_path);
+  }
+
+  SimulationState state;
+  std::chrono::nanoseconds elapsed_time(0);
+  if (!ReadCheckpoint(checkpoint_path, &state, simulation_time, &elapsed_time)) {
+    std::cerr << "Cannot read checkpoint " << checkpoint_path << std::endl;
+    exit(1);
+  }
+  simulation.RestoreState(state);
+  return elapsed_time;
+}
+
+// Converts a text checkpoint into a binary one. `simulation` must not have
+// particles and is left holding the converted state.
+bool ConvertTextCheckpoint(Simulation& simulation, std::string text_path, std::string output_path) {
+  double simulation_time = std::stod(std::filesystem::path(text_path).stem().string());
+  std::chrono::nanoseconds elapsed_time = LoadTextCheckpoint(simulation, text_path);
+  SimulationState state;
+  simulation.SaveState(&state);
+  return WriteCheckpoint(state, simulation_time, elapsed_time, output_path);
+}
+
 #endif
@@ -0,0 +1,56 @@
+#include "kernel_table.h"
+
+#include <cmath>
+#include <thread>
+
+
+namespace {
+
+// Smaller tables are built on the calling thread.
+constexpr size_t kMinValuesPerThread = 1 << 20;
+
+size_t NumValues(int cutoff) {
+  return (size_t) cutoff * (cutoff + 1) / 2;
+}
+
+} // namespace
+
+
+void KernelTable::Reset(int cutoff) {
+  cutoff_ = std::max(cutoff, 0);
+  values_ = std::vector<double>();
+}
+
+
+size_t KernelTable::Bytes(int cutoff) {
+  return NumValues(cutoff) * sizeof(double);
+}
+
+
+void KernelTable::Build(const RowFunction& fill_row, int num_threads) {
+  if (cutoff_ == 0) {
+    return;
+  }
+  size_t num_values = NumValues(cutoff_);
+  values_.resize(num_values);
+  num_threads = std::max(1, std::min<int>(num_threads, num_values / kMinValuesPerThread));
+
+  auto fill_rows = [&](int begin, int end) {
+    for (int row = begin; row < end; row++) {
+      fill_row(row, values_.data() + NumValues(row));
+    }
+  };
+  // Rows below cutoff * sqrt(t / num_threads) hold about a fraction
+  // t / num_threads of all values.
+  std::vector<std::thread> threads;
+  int begin = 0;
+  for (int t = 1; t < num_threads; t++) {
+    int end = std::max(begin, (int) (cutoff_ * std::sqrt((double) t / num_threads)));
+    threads.emplace_back(fill_rows, begin, end);
+    begin = end;
+  }
+  fill_rows(begin, cutoff_);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
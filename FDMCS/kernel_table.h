@@ -0,0 +1,45 @@
+#ifndef FDMCS_KERNEL_TABLE
+#define FDMCS_KERNEL_TABLE
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// Kernel values of all pairs of sizes below a cutoff.
+//
+// Kernels are symmetric, so only the lower triangle is stored: row `i` holds
+// the values for sizes (i, 0), ..., (i, i) and starts at i * (i + 1) / 2.
+// A cutoff of n takes n * (n + 1) / 2 doubles, 400 MB for n = 10000.
+class KernelTable {
+ public:
+  // Drops the values and tabulates sizes below `cutoff` on the next Build.
+  // A cutoff of 0 disables the table.
+  void Reset(int cutoff);
+
+  // Fills row `row` with `row + 1` values.
+  using RowFunction = std::function<void(int row, double* values)>;
+
+  // Computes all rows, split into ranges of about equal numbers of values
+  // among up to `num_threads` threads. `fill_row` is called concurrently.
+  void Build(const RowFunction& fill_row, int num_threads);
+
+  inline int Cutoff() const { return cutoff_; }
+  inline bool Built() const { return !values_.empty(); }
+
+  // Both sizes must be below Cutoff() and the table must be built.
+  inline double Get(long long first_size, long long second_size) const {
+    long long row = std::max(first_size, second_size);
+    long long column = std::min(first_size, second_size);
+    return values_[row * (row + 1) / 2 + column];
+  }
+
+  // Memory taken by a table with the given cutoff once it is built.
+  static size_t Bytes(int cutoff);
+
+ private:
+  int cutoff_ = 0;
+  std::vector<double> values_;
+};
+
+#endif
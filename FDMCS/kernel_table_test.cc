@@ -0,0 +1,47 @@
+#include "kernel_table.h"
+
+#include "gtest/gtest.h"
+
+
+void FillProducts(int row, double* values) {
+  for (int column = 0; column <= row; column++) {
+    values[column] = (row + 1.0) * (column + 1.0);
+  }
+}
+
+TEST(KernelTableTest, LookupsAreSymmetric) {
+  KernelTable table;
+  table.Reset(/*cutoff=*/100);
+  EXPECT_FALSE(table.Built());
+  table.Build(FillProducts, /*num_threads=*/1);
+  ASSERT_TRUE(table.Built());
+
+  for (int first = 0; first < 100; first++) {
+    for (int second = 0; second < 100; second++) {
+      EXPECT_EQ(table.Get(first, second), (first + 1.0) * (second + 1.0));
+    }
+  }
+
+  table.Reset(/*cutoff=*/10);
+  EXPECT_FALSE(table.Built());
+  EXPECT_EQ(table.Cutoff(), 10);
+}
+
+TEST(KernelTableTest, ParallelBuildFillsEveryRow) {
+  KernelTable table;
+  table.Reset(/*cutoff=*/3000);
+  table.Build(FillProducts, /*num_threads=*/4);
+
+  for (int first = 0; first < 3000; first += 7) {
+    for (int second = 0; second < 3000; second += 11) {
+      ASSERT_EQ(table.Get(first, second), (first + 1.0) * (second + 1.0));
+    }
+  }
+  EXPECT_EQ(table.Get(2999, 2999), 3000.0 * 3000.0);
+}
+
+TEST(KernelTableTest, BytesCoverTheLowerTriangle) {
+  EXPECT_EQ(KernelTable::Bytes(0), 0);
+  EXPECT_EQ(KernelTable::Bytes(4), 10 * sizeof(double));
+  EXPECT_EQ(KernelTable::Bytes(10000), 50005000 * sizeof(double));
+}
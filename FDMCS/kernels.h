@@ -0,0 +1,153 @@
+#ifndef FDMCS_KERNELS
+#define FDMCS_KERNELS
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+// Term f_first(x) * f_second(y) of a separable kernel, given by indices of the
+// per-size factors.
+typedef struct {
+  int first_factor;
+  int second_factor;
+} SeparableTerm;
+
+// Per-size values from which a kernel is evaluated inside of the O(N) loops.
+inline constexpr int kMaxKernelFeatures = 2;
+using KernelFeatures = std::array<double, kMaxKernelFeatures>;
+
+// Collision kernels are policy types for KernelSimulation. Every kernel
+// provides `double operator()(double, double) const` taking two sizes and
+// derives from KernelDefaults, which supplies the optional parts of the
+// interface.
+template <typename Derived>
+struct KernelDefaults {
+  // Upper bound of the kernel for sizes within the given inclusive ranges.
+  // Evaluates the corners of the ranges, which is exact for kernels monotone
+  // in both arguments.
+  double Bound(long long min_first, long long max_first,
+               long long min_second, long long max_second) const {
+    const Derived& kernel = static_cast<const Derived&>(*this);
+    return std::max({kernel(min_first, min_second), kernel(min_first, max_second),
+                     kernel(max_first, min_second), kernel(max_first, max_second)});
+  }
+
+  // Features of a size, computed once per group. Defaults to the size itself.
+  KernelFeatures Features(double size) const { return {size, 0.0}; }
+
+  // The kernel evaluated from the two features of both sizes. Kernels
+  // overriding Features evaluate it with multiplies, adds and at most one
+  // sqrt. Features are passed as scalars, so that the loops calling it stay
+  // vectorizable.
+  inline double FromFeatures(double first_a, double first_b,
+                             double second_a, double second_b) const {
+    return static_cast<const Derived&>(*this)(first_a, second_a);
+  }
+
+  inline double FromFeatures(const KernelFeatures& first, const KernelFeatures& second) const {
+    return static_cast<const Derived&>(*this).FromFeatures(first[0], first[1],
+                                                           second[0], second[1]);
+  }
+
+  // Separable form of the kernel, K(x, y) = sum_t f_first_t(x) * f_second_t(y).
+  // Kernels without such form return no terms.
+  std::vector<SeparableTerm> SeparableTerms() const { return {}; }
+
+  // Writes the values of all factors used by SeparableTerms for a size.
+  void SeparableFactors(long long size, double* factors) const {}
+};
+
+struct ConstantKernel : KernelDefaults<ConstantKernel> {
+  inline double operator()(double first_size, double second_size) const {
+    return 1.0;
+  }
+
+  std::vector<SeparableTerm> SeparableTerms() const { return {{0, 0}}; }
+
+  void SeparableFactors(long long size, double* factors) const {
+    factors[0] = 1.0;
+  }
+};
+
+struct MultiplicationKernel : KernelDefaults<MultiplicationKernel> {
+  inline double operator()(double first_size, double second_size) const {
+    return first_size * second_size / 100000.0;
+  }
+
+  std::vector<SeparableTerm> SeparableTerms() const { return {{0, 0}}; }
+
+  void SeparableFactors(long long size, double* factors) const {
+    factors[0] = size / sqrt(100000.0);
+  }
+};
+
+struct BallisticKernel : KernelDefaults<BallisticKernel> {
+  inline double operator()(double first_size, double second_size) const {
+    double first_term = pow(pow(first_size, 1.0/3.0) + pow(second_size, 1.0/3.0), 2.0);
+    double second_term = pow(1.0 / first_size + 1.0 / second_size, 0.5);
+    return first_term * second_term;
+  }
+
+  // Cube root and inverse of the size.
+  KernelFeatures Features(double size) const { return {cbrt(size), 1.0 / size}; }
+
+  using KernelDefaults::FromFeatures;
+  inline double FromFeatures(double first_a, double first_b,
+                             double second_a, double second_b) const {
+    double radius = first_a + second_a;
+    return radius * radius * sqrt(first_b + second_b);
+  }
+
+  // The first term grows and the second term decays in both sizes.
+  double Bound(long long min_first, long long max_first,
+               long long min_second, long long max_second) const {
+    double first_term = pow(pow(max_first, 1.0/3.0) + pow(max_second, 1.0/3.0), 2.0);
+    double second_term = pow(1.0 / min_first + 1.0 / min_second, 0.5);
+    return first_term * second_term;
+  }
+};
+
+struct BrownianKernel : KernelDefaults<BrownianKernel> {
+  // Implicit, so that simulations can be constructed directly from alpha.
+  BrownianKernel(double alpha) : alpha(alpha) {}
+
+  inline double operator()(double first_size, double second_size) const {
+    double fraction = first_size / second_size;
+    double inverse = second_size / first_size;
+    double first_term = pow(fraction, alpha);
+    double second_term = pow(inverse, alpha);
+    return first_term + second_term;
+  }
+
+  // size^alpha and size^-alpha.
+  KernelFeatures Features(double size) const {
+    double power = pow(size, alpha);
+    return {power, 1.0 / power};
+  }
+
+  using KernelDefaults::FromFeatures;
+  inline double FromFeatures(double first_a, double first_b,
+                             double second_a, double second_b) const {
+    return first_a * second_b + first_b * second_a;
+  }
+
+  // The kernel is convex in log(first_size / second_size), so the maximum is
+  // reached at one of the extreme ratios.
+  double Bound(long long min_first, long long max_first,
+               long long min_second, long long max_second) const {
+    return std::max((*this)(min_first, max_second), (*this)(max_first, min_second));
+  }
+
+  // (x/y)^a + (y/x)^a = x^a * y^-a + x^-a * y^a.
+  std::vector<SeparableTerm> SeparableTerms() const { return {{0, 1}, {1, 0}}; }
+
+  void SeparableFactors(long long size, double* factors) const {
+    factors[0] = pow(size, alpha);
+    factors[1] = 1.0 / factors[0];
+  }
+
+  double alpha;
+};
+
+#endif
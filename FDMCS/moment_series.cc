@@ -0,0 +1,59 @@
+#include "moment_series.h"
+
+#include <cstring>
+
+
+namespace {
+
+bool IsEmpty(const std::string& path) {
+  std::ifstream in(path, std::ios::in | std::ios::binary | std::ios::ate);
+  return !in || in.tellg() == 0;
+}
+
+} // namespace
+
+
+MomentSeriesWriter::MomentSeriesWriter(const std::string& path) {
+  bool is_new = IsEmpty(path);
+  out_.open(path, std::ios::out | std::ios::binary | std::ios::app);
+  if (out_ && is_new) {
+    MomentSeriesHeader header{};
+    std::memcpy(header.magic, kMomentSeriesMagic, sizeof(header.magic));
+    header.version = kMomentSeriesVersion;
+    header.record_size = sizeof(MomentRecord);
+    out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  }
+}
+
+
+void MomentSeriesWriter::Append(double simulation_time, const Moments& moments) {
+  MomentRecord record{simulation_time, double(moments.zeroth), double(moments.first),
+                      moments.second};
+  out_.write(reinterpret_cast<const char*>(&record), sizeof(record));
+}
+
+
+void MomentSeriesWriter::Flush() {
+  out_.flush();
+}
+
+
+bool ReadMomentSeries(const std::string& path, std::vector<MomentRecord>* records) {
+  std::ifstream in(path, std::ios::in | std::ios::binary);
+  MomentSeriesHeader header;
+  if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, kMomentSeriesMagic, sizeof(header.magic)) != 0 ||
+      header.version != kMomentSeriesVersion || header.record_size != sizeof(MomentRecord)) {
+    return false;
+  }
+
+  records->clear();
+  MomentRecord record;
+  while (in.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+    while (!records->empty() && records->back().simulation_time >= record.simulation_time) {
+      records->pop_back();
+    }
+    records->push_back(record);
+  }
+  return true;
+}
@@ -0,0 +1,55 @@
+#ifndef FDMCS_MOMENT_SERIES
+#define FDMCS_MOMENT_SERIES
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "simulation.h"
+
+inline constexpr char kMomentSeriesMagic[8] = "FDMCSMS";
+inline constexpr uint32_t kMomentSeriesVersion = 1;
+
+// Binary time series of the moments of a run.
+//
+// The file starts with this header and continues with one MomentRecord per
+// sample, all numbers in the byte order of the host. Runs resumed from a
+// checkpoint append to the series of the run they resume, so the time
+// steps back to the checkpoint where they start.
+struct MomentSeriesHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+};
+
+struct MomentRecord {
+  double simulation_time;
+  double zeroth;
+  double first;
+  double second;
+};
+
+// Appends records to a series, writing the header first if the file is new
+// or empty. Records are buffered and written by Flush or the destructor.
+class MomentSeriesWriter {
+ public:
+  explicit MomentSeriesWriter(const std::string& path);
+
+  void Append(double simulation_time, const Moments& moments);
+  void Flush();
+
+  // False if the file could not be opened or written.
+  inline bool Good() const { return bool(out_); }
+
+ private:
+  std::ofstream out_;
+};
+
+// Reads a series written by MomentSeriesWriter. Where the time steps back,
+// the earlier records from that time on are dropped in favour of the resumed
+// run. Returns false if the file cannot be read or is not a series of a
+// supported version.
+bool ReadMomentSeries(const std::string& path, std::vector<MomentRecord>* records);
+
+#endif
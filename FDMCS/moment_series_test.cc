@@ -0,0 +1,69 @@
+#include "moment_series.h"
+
+#include <cstdio>
+
+#include "gtest/gtest.h"
+
+
+TEST(MomentSeriesTest, RecordsRoundTrip) {
+  std::string path = testing::TempDir() + "/round_trip.bin";
+  std::remove(path.c_str());
+  {
+    MomentSeriesWriter writer(path);
+    writer.Append(0.5, Moments{10, 20, 50.0});
+    writer.Append(1.5, Moments{8, 20, 60.0});
+    ASSERT_TRUE(writer.Good());
+  }
+
+  std::vector<MomentRecord> records;
+  ASSERT_TRUE(ReadMomentSeries(path, &records));
+  ASSERT_EQ(records.size(), 2);
+  EXPECT_EQ(records[0].simulation_time, 0.5);
+  EXPECT_EQ(records[0].zeroth, 10);
+  EXPECT_EQ(records[0].first, 20);
+  EXPECT_EQ(records[0].second, 50.0);
+  EXPECT_EQ(records[1].simulation_time, 1.5);
+  EXPECT_EQ(records[1].zeroth, 8);
+  std::remove(path.c_str());
+}
+
+TEST(MomentSeriesTest, ResumedRunsReplaceLaterRecords) {
+  std::string path = testing::TempDir() + "/resumed.bin";
+  std::remove(path.c_str());
+  {
+    MomentSeriesWriter writer(path);
+    for (int i = 1; i <= 5; i++) {
+      writer.Append(i, Moments{i, 100, 0.0});
+    }
+  }
+  {
+    // Resumed from a checkpoint at time 3.
+    MomentSeriesWriter writer(path);
+    writer.Append(3.5, Moments{-1, 100, 0.0});
+    writer.Append(4.5, Moments{-2, 100, 0.0});
+  }
+
+  std::vector<MomentRecord> records;
+  ASSERT_TRUE(ReadMomentSeries(path, &records));
+  std::vector<double> times;
+  std::vector<double> zeroth;
+  for (const auto& record : records) {
+    times.push_back(record.simulation_time);
+    zeroth.push_back(record.zeroth);
+  }
+  EXPECT_EQ(times, (std::vector<double>{1, 2, 3, 3.5, 4.5}));
+  EXPECT_EQ(zeroth, (std::vector<double>{1, 2, 3, -1, -2}));
+  std::remove(path.c_str());
+}
+
+TEST(MomentSeriesTest, RejectsOtherFiles) {
+  std::string path = testing::TempDir() + "/not_a_series.bin";
+  {
+    std::ofstream out(path);
+    out << "not a moment series";
+  }
+  std::vector<MomentRecord> records;
+  EXPECT_FALSE(ReadMomentSeries(path, &records));
+  EXPECT_FALSE(ReadMomentSeries(testing::TempDir() + "/missing.bin", &records));
+  std::remove(path.c_str());
+}
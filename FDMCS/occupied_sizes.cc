@@ -0,0 +1,28 @@
+#include "occupied_sizes.h"
+
+
+OccupiedSizes::OccupiedSizes(int capacity) : words_((capacity + 63) / 64, 0), extent_(0) {}
+
+
+void OccupiedSizes::Insert(int size) {
+  words_[size / 64] |= uint64_t{1} << (size % 64);
+  if (size >= extent_) {
+    extent_ = size + 1;
+  }
+}
+
+
+void OccupiedSizes::Erase(int size) {
+  words_[size / 64] &= ~(uint64_t{1} << (size % 64));
+  if (size + 1 < extent_) {
+    return;
+  }
+  for (int word_idx = size / 64; word_idx >= 0; word_idx--) {
+    uint64_t word = words_[word_idx];
+    if (word != 0) {
+      extent_ = word_idx * 64 + 64 - __builtin_clzll(word);
+      return;
+    }
+  }
+  extent_ = 0;
+}
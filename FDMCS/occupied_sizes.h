@@ -0,0 +1,76 @@
+#ifndef FDMCS_OCCUPIED_SIZES
+#define FDMCS_OCCUPIED_SIZES
+
+#include <cstdint>
+#include <vector>
+
+// Bitset of the small sizes that currently hold particles.
+//
+// Loops over small groups visit only the blocks of 64 sizes that hold at
+// least one particle, and within such a block only the range between its
+// first and last occupied size. Ranges stay contiguous, so the loops keep
+// their vectorized form and visit groups in increasing size.
+class OccupiedSizes {
+ public:
+  explicit OccupiedSizes(int capacity);
+
+  void Insert(int size);
+  void Erase(int size);
+
+  inline bool Contains(int size) const {
+    return (words_[size / 64] >> (size % 64)) & 1;
+  }
+
+  // One past the largest occupied size, 0 if there is none.
+  inline int Extent() const { return extent_; }
+
+  // Number of blocks of 64 sizes below Extent().
+  inline int NumBlocks() const { return (extent_ + 63) / 64; }
+
+  // Calls `visit(begin, end)` for the occupied range of every non-empty
+  // block, in increasing order. Ranges may include empty sizes.
+  template <typename Visitor>
+  void ForEachRange(Visitor visit) const {
+    ForEachRangeInBlocks(0, NumBlocks(), visit);
+  }
+
+  // Same as ForEachRange, restricted to blocks [first_block, last_block).
+  template <typename Visitor>
+  void ForEachRangeInBlocks(int first_block, int last_block, Visitor visit) const {
+    for (int word_idx = first_block; word_idx < last_block; word_idx++) {
+      uint64_t word = words_[word_idx];
+      if (word == 0) {
+        continue;
+      }
+      int base = word_idx * 64;
+      visit(base + __builtin_ctzll(word), base + 64 - __builtin_clzll(word));
+    }
+  }
+
+  // Same as ForEachRange, but stops as soon as `visit` returns true.
+  template <typename Visitor>
+  bool FindInRanges(Visitor visit) const {
+    return FindInRangesInBlocks(0, NumBlocks(), visit);
+  }
+
+  template <typename Visitor>
+  bool FindInRangesInBlocks(int first_block, int last_block, Visitor visit) const {
+    for (int word_idx = first_block; word_idx < last_block; word_idx++) {
+      uint64_t word = words_[word_idx];
+      if (word == 0) {
+        continue;
+      }
+      int base = word_idx * 64;
+      if (visit(base + __builtin_ctzll(word), base + 64 - __builtin_clzll(word))) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  std::vector<uint64_t> words_;
+  int extent_;
+};
+
+#endif
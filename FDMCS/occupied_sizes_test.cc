@@ -0,0 +1,72 @@
+#include "occupied_sizes.h"
+
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+
+std::vector<std::pair<int, int>> Ranges(const OccupiedSizes& sizes) {
+  std::vector<std::pair<int, int>> ranges;
+  sizes.ForEachRange([&](int begin, int end) { ranges.push_back({begin, end}); });
+  return ranges;
+}
+
+TEST(OccupiedSizesTest, RangesSpanOccupiedBlocks) {
+  OccupiedSizes sizes(/*capacity=*/1000);
+  EXPECT_TRUE(Ranges(sizes).empty());
+
+  sizes.Insert(3);
+  sizes.Insert(10);
+  sizes.Insert(130);
+  sizes.Insert(191);
+  sizes.Insert(700);
+
+  std::vector<std::pair<int, int>> expected{{3, 11}, {130, 192}, {700, 701}};
+  EXPECT_EQ(Ranges(sizes), expected);
+  EXPECT_TRUE(sizes.Contains(130));
+  EXPECT_FALSE(sizes.Contains(131));
+}
+
+TEST(OccupiedSizesTest, ExtentShrinksToLargestOccupied) {
+  OccupiedSizes sizes(/*capacity=*/1000);
+  sizes.Insert(5);
+  sizes.Insert(200);
+  sizes.Insert(900);
+  EXPECT_EQ(sizes.Extent(), 901);
+
+  sizes.Erase(200);
+  EXPECT_EQ(sizes.Extent(), 901);
+  sizes.Erase(900);
+  EXPECT_EQ(sizes.Extent(), 6);
+  sizes.Erase(5);
+  EXPECT_EQ(sizes.Extent(), 0);
+}
+
+TEST(OccupiedSizesTest, FindInRangesStopsEarly) {
+  OccupiedSizes sizes(/*capacity=*/1000);
+  sizes.Insert(1);
+  sizes.Insert(100);
+  sizes.Insert(300);
+
+  int visited = 0;
+  bool found = sizes.FindInRanges([&](int begin, int end) {
+    visited++;
+    return begin <= 100 && 100 < end;
+  });
+  EXPECT_TRUE(found);
+  EXPECT_EQ(visited, 2);
+}
+
+TEST(OccupiedSizesTest, RangesInBlocksSkipOtherBlocks) {
+  OccupiedSizes sizes(/*capacity=*/1000);
+  sizes.Insert(3);
+  sizes.Insert(130);
+  sizes.Insert(700);
+  EXPECT_EQ(sizes.NumBlocks(), 11);
+
+  std::vector<std::pair<int, int>> ranges;
+  sizes.ForEachRangeInBlocks(1, 11, [&](int begin, int end) { ranges.push_back({begin, end}); });
+  std::vector<std::pair<int, int>> expected{{130, 131}, {700, 701}};
+  EXPECT_EQ(ranges, expected);
+}
@@ -1,24 +1,74 @@
 import os
+import struct
 import numpy as np
 
+# Layout of CheckpointHeader from checkpoint.h.
+CHECKPOINT_HEADER = struct.Struct('<8sIIdqifiiddqqqqiiqqQQQQQQQQq')
+
+
+def read_checkpoint(path):
+  """Returns sizes, counts and the elapsed wall time of a checkpoint.
+
+  Handles binary checkpoints (.ckpt) as well as text checkpoints (.cpt).
+  """
+  if path.endswith('.cpt'):
+    particles = []
+    with open(path) as f:
+      duration = float(f.readline().strip())
+      for line in f:
+        particles.append(list(map(float, line.strip().split())))
+    sizes, counts, _ = zip(*particles)
+    return np.array(sizes), np.array(counts), duration
+
+  data = np.memmap(path, dtype=np.uint8, mode='r')
+  header = CHECKPOINT_HEADER.unpack_from(data)
+  duration = header[4]
+  num_small, num_big = header[17], header[18]
+  small_offset, big_offset = header[20], header[21]
+  small = np.frombuffer(data, dtype=np.float64, count=3 * num_small, offset=small_offset)
+  big = np.frombuffer(data, dtype=np.float64, count=3 * num_big, offset=big_offset)
+  counts = np.concatenate([small[:num_small], big[:num_big]])
+  sizes = np.concatenate([small[num_small:2 * num_small], big[num_big:2 * num_big]])
+  occupied = counts > 0
+  return sizes[occupied], counts[occupied], duration
+
+
+# Layout of MomentSeriesHeader and MomentRecord from moment_series.h.
+MOMENT_SERIES_HEADER = struct.Struct('<8sII')
+MOMENT_RECORD = np.dtype([('time', '<f8'), ('m0', '<f8'), ('m1', '<f8'), ('m2', '<f8')])
+
+
+def read_moments(path):
+  """Returns the moment series written to moments.bin as a record array.
+
+  Where a resumed run steps back in time, the earlier records from that time
+  on are dropped, as in ReadMomentSeries.
+  """
+  data = np.fromfile(path, dtype=np.uint8)
+  magic, _, record_size = MOMENT_SERIES_HEADER.unpack_from(data)
+  assert magic == b'FDMCSMS\0' and record_size == MOMENT_RECORD.itemsize
+  records = np.frombuffer(data, dtype=MOMENT_RECORD, offset=MOMENT_SERIES_HEADER.size)
+  if len(records) == 0:
+    return records
+  # A record is kept if every later record has a later time.
+  later_min = np.minimum.accumulate(records['time'][::-1])[::-1]
+  keep = np.append(records['time'][:-1] < later_min[1:], True)
+  return records[keep]
+
+
+def extract_time(filename):
+  return float(os.path.splitext(filename)[0])
+
+
 class DataLoader():
   def __init__(self, dir):
     self.dir = dir
 
-    self.files = os.listdir(self.dir)
+    self.files = [f for f in os.listdir(self.dir) if f.endswith(('.cpt', '.ckpt'))]
     self.files.sort(key=self.extract_time)
 
   def __getitem__(self, idx):
-    particles = []
-    duration = None
-    with open(os.path.join(self.dir, self.files[idx])) as f:
-      duration = float(f.readline().strip())
-      for line in f:
-          particles.append(list(map(float, line.strip().split())))
-
-    sizes, counts, _ = zip(*particles)
-    sizes = np.array(sizes)
-    counts = np.array(counts)
+    sizes, counts, duration = read_checkpoint(os.path.join(self.dir, self.files[idx]))
     return sizes, counts / np.sum(counts * sizes), self.extract_time(self.files[idx]), duration
 
   def __len__(self):
@@ -26,25 +76,18 @@ class DataLoader():
 
   @staticmethod
   def extract_time(filename):
-    return float(filename.replace('.cpt', ''))
+    return extract_time(filename)
 
 
 class FDMCSDataLoader():
   def __init__(self, dir):
     self.dir = dir
 
-    self.files = os.listdir(self.dir)
+    self.files = [f for f in os.listdir(self.dir) if f.endswith(('.cpt', '.ckpt'))]
     self.files.sort(key=self.extract_time)
 
   def __getitem__(self, idx):
-    particles = []
-    duration = None
-    with open(os.path.join(self.dir, self.files[idx])) as f:
-      duration = float(f.readline().strip())
-      for line in f:
-          particles.append(list(map(float, line.strip().split())))
-
-    sizes, counts, _ = zip(*particles)
+    sizes, counts, duration = read_checkpoint(os.path.join(self.dir, self.files[idx]))
     sizes, counts = self.aggregate_counts(sizes, counts)
     return sizes, counts / np.sum(counts * sizes), self.extract_time(self.files[idx]), duration
 
@@ -53,7 +96,7 @@ class FDMCSDataLoader():
 
   @staticmethod
   def extract_time(filename):
-    return float(filename.replace('.cpt', ''))
+    return extract_time(filename)
 
   @staticmethod
   def aggregate_counts(sizes, counts):
@@ -0,0 +1,44 @@
+#include "profile.h"
+
+#include <iterator>
+
+
+namespace {
+
+constexpr const char* kPhaseNames[] = {
+    "find_first",      "find_second",     "find_majorant_pair", "find_low_rank_pair",
+    "add_particle",    "add_particles",   "delete_particle",    "count_class_rates",
+    "duplicate_particles",
+};
+
+constexpr const char* kEventNames[] = {
+    "aggregation", "fragmentation", "rejection", "duplication",
+};
+
+static_assert(std::size(kPhaseNames) == static_cast<int>(Phase::kNumPhases));
+static_assert(std::size(kEventNames) == static_cast<int>(Event::kNumEvents));
+
+} // namespace
+
+
+Profile::Profile() : big_groups_(0), max_big_groups_(0) {
+  phase_cycles_.fill(0);
+  phase_calls_.fill(0);
+  event_counts_.fill(0);
+}
+
+
+void Profile::WriteJson(double simulation_time, std::ostream& out) const {
+  out << "{\"simulation_time\": " << simulation_time << ", \"phases\": {";
+  for (size_t phase = 0; phase < phase_cycles_.size(); phase++) {
+    out << (phase > 0 ? ", " : "") << "\"" << kPhaseNames[phase] << "\": {\"calls\": "
+        << phase_calls_[phase] << ", \"cycles\": " << phase_cycles_[phase] << "}";
+  }
+  out << "}, \"events\": {";
+  for (size_t event = 0; event < event_counts_.size(); event++) {
+    out << (event > 0 ? ", " : "") << "\"" << kEventNames[event] << "\": "
+        << event_counts_[event];
+  }
+  out << "}, \"big_groups\": " << big_groups_ << ", \"max_big_groups\": " << max_big_groups_
+      << "}\n";
+}
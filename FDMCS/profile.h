@@ -0,0 +1,120 @@
+#ifndef FDMCS_PROFILE
+#define FDMCS_PROFILE
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <ostream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+// Profiling is compiled in with FDMCS_ENABLE_PROFILING, see the `profile`
+// config in .bazelrc. Without it every call below compiles to nothing.
+#ifdef FDMCS_ENABLE_PROFILING
+inline constexpr bool kProfilingEnabled = true;
+#else
+inline constexpr bool kProfilingEnabled = false;
+#endif
+
+// Parts of RunSimulationStep timed by Profile.
+enum class Phase {
+  kFindFirst,
+  kFindSecond,
+  kFindMajorantPair,
+  kFindLowRankPair,
+  kAddParticle,
+  // AddParticles, which also covers AddMonomers.
+  kAddParticles,
+  kDeleteParticle,
+  // Recount of the size-class majorant rates every 1000 steps, by the
+  // majorant selection and the SIZE_CLASSES second sampler.
+  kCountClassRates,
+  kDuplicateParticles,
+  kNumPhases,
+};
+
+enum class Event {
+  kAggregation,
+  kFragmentation,
+  // Pairs rejected by the majorant selection.
+  kRejection,
+  kDuplication,
+  kNumEvents,
+};
+
+// Time stamp counter on x86, nanoseconds elsewhere.
+inline uint64_t ReadTimestamp() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Cycles and calls per phase, event counts and the number of big particle
+// groups of a simulation.
+class Profile {
+ public:
+  Profile();
+
+  inline void AddPhase(Phase phase, uint64_t cycles) {
+    if constexpr (kProfilingEnabled) {
+      phase_cycles_[static_cast<int>(phase)] += cycles;
+      phase_calls_[static_cast<int>(phase)] += 1;
+    }
+  }
+
+  inline void CountEvent(Event event) {
+    if constexpr (kProfilingEnabled) {
+      event_counts_[static_cast<int>(event)] += 1;
+    }
+  }
+
+  inline void TrackBigGroups(long long num_big_groups) {
+    if constexpr (kProfilingEnabled) {
+      big_groups_ = num_big_groups;
+      max_big_groups_ = std::max(max_big_groups_, num_big_groups);
+    }
+  }
+
+  inline uint64_t PhaseCycles(Phase phase) const { return phase_cycles_[static_cast<int>(phase)]; }
+  inline uint64_t PhaseCalls(Phase phase) const { return phase_calls_[static_cast<int>(phase)]; }
+  inline uint64_t EventCount(Event event) const { return event_counts_[static_cast<int>(event)]; }
+  inline long long BigGroups() const { return big_groups_; }
+  inline long long MaxBigGroups() const { return max_big_groups_; }
+
+  // Writes the profile as a single line of JSON.
+  void WriteJson(double simulation_time, std::ostream& out) const;
+
+ private:
+  std::array<uint64_t, static_cast<int>(Phase::kNumPhases)> phase_cycles_;
+  std::array<uint64_t, static_cast<int>(Phase::kNumPhases)> phase_calls_;
+  std::array<uint64_t, static_cast<int>(Event::kNumEvents)> event_counts_;
+  long long big_groups_;
+  long long max_big_groups_;
+};
+
+// Adds the cycles spent in its scope to a phase.
+class ScopedPhase {
+ public:
+  inline ScopedPhase(Profile* profile, Phase phase)
+      : profile_(profile), phase_(phase), start_(kProfilingEnabled ? ReadTimestamp() : 0) {}
+
+  inline ~ScopedPhase() {
+    if constexpr (kProfilingEnabled) {
+      profile_->AddPhase(phase_, ReadTimestamp() - start_);
+    }
+  }
+
+ private:
+  Profile* profile_;
+  Phase phase_;
+  uint64_t start_;
+};
+
+#endif
@@ -0,0 +1,38 @@
+#include "profile.h"
+
+#include <sstream>
+
+#include "gtest/gtest.h"
+
+
+TEST(ProfileTest, CountsOnlyWhenEnabled) {
+  Profile profile;
+  {
+    ScopedPhase scoped_phase(&profile, Phase::kFindFirst);
+  }
+  profile.AddPhase(Phase::kDeleteParticle, 10);
+  profile.CountEvent(Event::kAggregation);
+  profile.TrackBigGroups(5);
+  profile.TrackBigGroups(3);
+
+  int expected = kProfilingEnabled ? 1 : 0;
+  EXPECT_EQ(profile.PhaseCalls(Phase::kFindFirst), expected);
+  EXPECT_EQ(profile.PhaseCalls(Phase::kFindSecond), 0);
+  EXPECT_EQ(profile.PhaseCycles(Phase::kDeleteParticle), 10 * expected);
+  EXPECT_EQ(profile.EventCount(Event::kAggregation), expected);
+  EXPECT_EQ(profile.BigGroups(), 3 * expected);
+  EXPECT_EQ(profile.MaxBigGroups(), 5 * expected);
+}
+
+TEST(ProfileTest, WritesJsonLine) {
+  Profile profile;
+  std::ostringstream out;
+  profile.WriteJson(1.5, out);
+
+  std::string json = out.str();
+  EXPECT_EQ(json.rfind("{\"simulation_time\": 1.5, ", 0), 0);
+  EXPECT_NE(json.find("\"duplicate_particles\": {\"calls\": 0, \"cycles\": 0}"),
+            std::string::npos);
+  EXPECT_NE(json.find("\"events\": {\"aggregation\": 0, "), std::string::npos);
+  EXPECT_EQ(json.back(), '\n');
+}
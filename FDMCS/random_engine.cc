@@ -0,0 +1,209 @@
+#include "random_engine.h"
+
+#include <sstream>
+
+
+namespace {
+
+uint64_t SplitMix64(uint64_t* state) {
+  uint64_t value = (*state += 0x9E3779B97F4A7C15);
+  value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9;
+  value = (value ^ (value >> 27)) * 0x94D049BB133111EB;
+  return value ^ (value >> 31);
+}
+
+constexpr std::array<uint64_t, 4> kXoshiroJump = {
+    0x180EC6D33CFD0ABA, 0xD5A61266F0C9392C, 0xA9582618E03FC9AA, 0x39ABDC4529B1661C};
+
+constexpr uint32_t kPhiloxMultipliers[2] = {0xD2511F53, 0xCD9E8D57};
+constexpr uint32_t kPhiloxKeySteps[2] = {0x9E3779B9, 0xBB67AE85};
+constexpr int kPhiloxRounds = 10;
+
+const char kXoshiroName[] = "xoshiro256++";
+const char kPcgName[] = "pcg64";
+const char kPhiloxName[] = "philox4x32";
+
+} // namespace
+
+
+Xoshiro256PlusPlus::Xoshiro256PlusPlus(uint64_t seed, uint64_t stream) {
+  for (uint64_t& word : state) {
+    word = SplitMix64(&seed);
+  }
+  for (uint64_t jump = 0; jump < stream; jump++) {
+    Jump();
+  }
+}
+
+
+void Xoshiro256PlusPlus::Jump() {
+  std::array<uint64_t, 4> jumped = {0, 0, 0, 0};
+  for (uint64_t mask : kXoshiroJump) {
+    for (int bit = 0; bit < 64; bit++) {
+      if (mask & uint64_t(1) << bit) {
+        for (int i = 0; i < 4; i++) {
+          jumped[i] ^= state[i];
+        }
+      }
+      (*this)();
+    }
+  }
+  state = jumped;
+}
+
+
+Pcg64::Pcg64(uint64_t seed, uint64_t stream)
+    : state(0), increment((unsigned __int128)(stream) << 1 | 1) {
+  state = (seed + increment) * kMultiplier + increment;
+}
+
+
+Philox4x32::Philox4x32(uint64_t seed, uint64_t stream)
+    : key{uint32_t(seed), uint32_t(seed >> 32)},
+      counter{0, 0, uint32_t(stream), uint32_t(stream >> 32)},
+      output{0, 0, 0, 0},
+      index(4) {}
+
+
+std::array<uint32_t, 4> Philox4x32::Bijection(std::array<uint32_t, 4> counter,
+                                              std::array<uint32_t, 2> key) {
+  for (int round = 0; round < kPhiloxRounds; round++) {
+    if (round > 0) {
+      key[0] += kPhiloxKeySteps[0];
+      key[1] += kPhiloxKeySteps[1];
+    }
+    uint64_t first = uint64_t(kPhiloxMultipliers[0]) * counter[0];
+    uint64_t second = uint64_t(kPhiloxMultipliers[1]) * counter[2];
+    counter = {uint32_t(second >> 32) ^ counter[1] ^ key[0], uint32_t(second),
+               uint32_t(first >> 32) ^ counter[3] ^ key[1], uint32_t(first)};
+  }
+  return counter;
+}
+
+
+void Philox4x32::NextBlock() {
+  output = Bijection(counter, key);
+  index = 0;
+  for (uint32_t& word : counter) {
+    if (++word != 0) {
+      break;
+    }
+  }
+}
+
+
+RandomEngine::RandomEngine(RngEngine type, uint64_t seed, uint64_t stream) {
+  switch (type) {
+    case RngEngine::kMt19937 :
+      if (stream == 0 && seed >> 32 == 0) {
+        engine_ = std::mt19937(seed);
+      } else {
+        std::seed_seq sequence{uint32_t(seed), uint32_t(seed >> 32), uint32_t(stream)};
+        engine_ = std::mt19937(sequence);
+      }
+      break;
+    case RngEngine::kXoshiro256PlusPlus :
+      engine_ = Xoshiro256PlusPlus(seed, stream);
+      break;
+    case RngEngine::kPcg64 :
+      engine_ = Pcg64(seed, stream);
+      break;
+    case RngEngine::kPhilox4x32 :
+      engine_ = Philox4x32(seed, stream);
+      break;
+  }
+}
+
+
+std::string RandomEngine::Serialize() const {
+  std::ostringstream out;
+  switch (Type()) {
+    case RngEngine::kMt19937 :
+      out << *std::get_if<std::mt19937>(&engine_);
+      break;
+    case RngEngine::kXoshiro256PlusPlus : {
+      const Xoshiro256PlusPlus& engine = *std::get_if<Xoshiro256PlusPlus>(&engine_);
+      out << kXoshiroName;
+      for (uint64_t word : engine.state) {
+        out << " " << word;
+      }
+      break;
+    }
+    case RngEngine::kPcg64 : {
+      const Pcg64& engine = *std::get_if<Pcg64>(&engine_);
+      out << kPcgName << " " << uint64_t(engine.state >> 64) << " " << uint64_t(engine.state)
+          << " " << uint64_t(engine.increment >> 64) << " " << uint64_t(engine.increment);
+      break;
+    }
+    case RngEngine::kPhilox4x32 : {
+      const Philox4x32& engine = *std::get_if<Philox4x32>(&engine_);
+      out << kPhiloxName;
+      for (uint32_t word : engine.key) {
+        out << " " << word;
+      }
+      for (uint32_t word : engine.counter) {
+        out << " " << word;
+      }
+      for (uint32_t word : engine.output) {
+        out << " " << word;
+      }
+      out << " " << engine.index;
+      break;
+    }
+  }
+  return out.str();
+}
+
+
+bool RandomEngine::Deserialize(const std::string& state) {
+  std::istringstream in(state);
+  std::string name;
+  in >> name;
+  if (name == kXoshiroName) {
+    Xoshiro256PlusPlus engine(0, 0);
+    for (uint64_t& word : engine.state) {
+      in >> word;
+    }
+    if (!in) {
+      return false;
+    }
+    engine_ = engine;
+  } else if (name == kPcgName) {
+    uint64_t words[4];
+    for (uint64_t& word : words) {
+      in >> word;
+    }
+    if (!in) {
+      return false;
+    }
+    Pcg64 engine(0, 0);
+    engine.state = (unsigned __int128)(words[0]) << 64 | words[1];
+    engine.increment = (unsigned __int128)(words[2]) << 64 | words[3];
+    engine_ = engine;
+  } else if (name == kPhiloxName) {
+    Philox4x32 engine(0, 0);
+    for (uint32_t& word : engine.key) {
+      in >> word;
+    }
+    for (uint32_t& word : engine.counter) {
+      in >> word;
+    }
+    for (uint32_t& word : engine.output) {
+      in >> word;
+    }
+    in >> engine.index;
+    if (!in || engine.index < 0 || engine.index > 4 || engine.index % 2 != 0) {
+      return false;
+    }
+    engine_ = engine;
+  } else {
+    std::istringstream mt_in(state);
+    std::mt19937 engine;
+    mt_in >> engine;
+    if (!mt_in) {
+      return false;
+    }
+    engine_ = engine;
+  }
+  return true;
+}
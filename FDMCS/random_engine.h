@@ -0,0 +1,160 @@
+#ifndef FDMCS_RANDOM_ENGINE
+#define FDMCS_RANDOM_ENGINE
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <string>
+#include <variant>
+
+enum class RngEngine {
+  // 2.5 KB of state. The default, so that existing seeds repeat their runs.
+  kMt19937,
+  // xoshiro256++ of Blackman and Vigna, 32 bytes of state.
+  kXoshiro256PlusPlus,
+  // PCG64 (XSL RR 128/64) of O'Neill, 32 bytes of state.
+  kPcg64,
+  // Philox4x32-10 of Salmon et al. Counter-based: block b of stream s is a
+  // fixed function of (seed, s, b), so streams need no state to split.
+  kPhilox4x32,
+};
+
+class Xoshiro256PlusPlus {
+ public:
+  // Seeds the state with splitmix64 of `seed` and advances it by 2^128
+  // draws for every stream, so streams do not overlap.
+  Xoshiro256PlusPlus(uint64_t seed, uint64_t stream);
+
+  inline uint64_t operator()() {
+    uint64_t result = Rotate(state[0] + state[3], 23) + state[0];
+    uint64_t shifted = state[1] << 17;
+    state[2] ^= state[0];
+    state[3] ^= state[1];
+    state[1] ^= state[2];
+    state[0] ^= state[3];
+    state[2] ^= shifted;
+    state[3] = Rotate(state[3], 45);
+    return result;
+  }
+
+  std::array<uint64_t, 4> state;
+
+ private:
+  static inline uint64_t Rotate(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+  }
+
+  void Jump();
+};
+
+class Pcg64 {
+ public:
+  // The stream selects the increment of the underlying LCG.
+  Pcg64(uint64_t seed, uint64_t stream);
+
+  inline uint64_t operator()() {
+    state = state * kMultiplier + increment;
+    uint64_t value = uint64_t(state >> 64) ^ uint64_t(state);
+    int rotation = state >> 122;
+    return (value >> rotation) | (value << (-rotation & 63));
+  }
+
+  unsigned __int128 state;
+  unsigned __int128 increment;
+
+ private:
+  static constexpr unsigned __int128 kMultiplier =
+      (unsigned __int128)(2549297995355413924ULL) << 64 | 4865540595714422341ULL;
+};
+
+class Philox4x32 {
+ public:
+  // Key `seed`, with the stream in the upper half of the counter and the
+  // block in the lower half.
+  Philox4x32(uint64_t seed, uint64_t stream);
+
+  inline uint64_t operator()() {
+    if (index >= 4) {
+      NextBlock();
+    }
+    uint64_t value = output[index] | uint64_t(output[index + 1]) << 32;
+    index += 2;
+    return value;
+  }
+
+  // The ten rounds that map a counter to a block of four words.
+  static std::array<uint32_t, 4> Bijection(std::array<uint32_t, 4> counter,
+                                           std::array<uint32_t, 2> key);
+
+  std::array<uint32_t, 2> key;
+  // Counter of the next block.
+  std::array<uint32_t, 4> counter;
+  std::array<uint32_t, 4> output;
+  // Next unused word of output, 4 if all are used.
+  int index;
+
+ private:
+  void NextBlock();
+};
+
+// Uniform random bit generator that is one of the engines above, chosen at
+// run time like the samplers of Simulation. Every draw is 64 bits, and
+// std::mt19937 supplies two outputs per draw, low word first. Uniform
+// doubles drawn from it are therefore the same as those that
+// std::uniform_real_distribution draws from std::mt19937 itself.
+class RandomEngine {
+ public:
+  using result_type = uint64_t;
+
+  static constexpr uint64_t min() { return 0; }
+  static constexpr uint64_t max() { return std::numeric_limits<uint64_t>::max(); }
+
+  RandomEngine() = default;
+  // Implicit, so that a std::mt19937 can be passed wherever an engine is
+  // expected.
+  RandomEngine(std::mt19937 engine) : engine_(engine) {}
+  // Engine for stream `stream` of `seed`. std::mt19937 has no streams: it
+  // takes seeds below 2^32 of stream 0 directly, like std::mt19937(seed),
+  // and other seeds and streams from the sequence (seed low word, seed high
+  // word, stream).
+  RandomEngine(RngEngine type, uint64_t seed, uint64_t stream = 0);
+
+  inline RngEngine Type() const { return RngEngine(engine_.index()); }
+
+  inline uint64_t operator()() {
+    switch (Type()) {
+      case RngEngine::kMt19937 : {
+        std::mt19937& engine = *std::get_if<std::mt19937>(&engine_);
+        uint64_t low = engine();
+        return low | uint64_t(engine()) << 32;
+      }
+      case RngEngine::kXoshiro256PlusPlus :
+        return (*std::get_if<Xoshiro256PlusPlus>(&engine_))();
+      case RngEngine::kPcg64 :
+        return (*std::get_if<Pcg64>(&engine_))();
+      case RngEngine::kPhilox4x32 :
+        return (*std::get_if<Philox4x32>(&engine_))();
+    }
+    return 0;
+  }
+
+  // Uniform in [0, 1), equal to a draw of
+  // std::uniform_real_distribution<double>(0, 1) without constructing one.
+  inline double Uniform() {
+    return std::generate_canonical<double, std::numeric_limits<double>::digits>(*this);
+  }
+
+  // Text form of the engine and its state. std::mt19937 keeps the form of
+  // its stream operator, so older checkpoints can still be read.
+  std::string Serialize() const;
+  // Restores the engine and its type from Serialize. False if `state` is
+  // malformed, in which case the engine is unchanged.
+  bool Deserialize(const std::string& state);
+
+ private:
+  // In the order of RngEngine.
+  std::variant<std::mt19937, Xoshiro256PlusPlus, Pcg64, Philox4x32> engine_;
+};
+
+#endif
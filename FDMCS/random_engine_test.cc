@@ -0,0 +1,86 @@
+#include "random_engine.h"
+
+#include <random>
+#include <set>
+
+#include "gtest/gtest.h"
+
+
+constexpr RngEngine kEngines[] = {RngEngine::kMt19937, RngEngine::kXoshiro256PlusPlus,
+                                  RngEngine::kPcg64, RngEngine::kPhilox4x32};
+
+TEST(RandomEngineTest, PhiloxMatchesKnownAnswers) {
+  // Known-answer vectors of the Random123 reference implementation.
+  EXPECT_EQ(Philox4x32::Bijection({0, 0, 0, 0}, {0, 0}),
+            (std::array<uint32_t, 4>{0x6627E8D5, 0xE169C58D, 0xBC57AC4C, 0x9B00DBD8}));
+  EXPECT_EQ(Philox4x32::Bijection({0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF},
+                                  {0xFFFFFFFF, 0xFFFFFFFF}),
+            (std::array<uint32_t, 4>{0x408F276D, 0x41C83B0E, 0xA20BC7C6, 0x6D5451FD}));
+}
+
+TEST(RandomEngineTest, XoshiroMatchesReference) {
+  Xoshiro256PlusPlus engine(0, 0);
+  engine.state = {1, 2, 3, 4};
+  EXPECT_EQ(engine(), (uint64_t(5) << 23) + 1);
+}
+
+TEST(RandomEngineTest, Mt19937MatchesStandardDistribution) {
+  std::mt19937 reference(11);
+  RandomEngine engine(RngEngine::kMt19937, 11);
+  std::uniform_real_distribution<double> unit_dist(0, 1.0);
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_EQ(engine.Uniform(), unit_dist(reference));
+  }
+
+  std::mt19937 default_reference;
+  RandomEngine default_engine;
+  EXPECT_EQ(default_engine.Uniform(), unit_dist(default_reference));
+}
+
+TEST(RandomEngineTest, StreamsAreDistinctAndRepeatable) {
+  for (RngEngine type : kEngines) {
+    std::set<uint64_t> first_draws;
+    for (int stream = 0; stream < 8; stream++) {
+      RandomEngine engine(type, /*seed=*/42, stream);
+      RandomEngine repeated(type, /*seed=*/42, stream);
+      uint64_t draw = engine();
+      EXPECT_EQ(draw, repeated());
+      first_draws.insert(draw);
+    }
+    EXPECT_EQ(first_draws.size(), 8);
+  }
+}
+
+TEST(RandomEngineTest, SerializationRestoresTheStream) {
+  for (RngEngine type : kEngines) {
+    RandomEngine engine(type, /*seed=*/7, /*stream=*/3);
+    // An odd number of draws leaves Philox in the middle of a block.
+    for (int i = 0; i < 5; i++) {
+      engine();
+    }
+    RandomEngine restored(RngEngine::kPcg64, /*seed=*/1);
+    ASSERT_TRUE(restored.Deserialize(engine.Serialize()));
+    EXPECT_EQ(restored.Type(), type);
+    for (int i = 0; i < 10; i++) {
+      EXPECT_EQ(restored(), engine());
+    }
+  }
+
+  RandomEngine engine;
+  EXPECT_FALSE(engine.Deserialize("philox4x32 1 2"));
+  EXPECT_EQ(engine.Type(), RngEngine::kMt19937);
+}
+
+TEST(RandomEngineTest, UniformDrawsHaveTheRightMean) {
+  for (RngEngine type : kEngines) {
+    RandomEngine engine(type, /*seed=*/3);
+    double sum = 0;
+    for (int i = 0; i < 100000; i++) {
+      double value = engine.Uniform();
+      ASSERT_GE(value, 0);
+      ASSERT_LT(value, 1);
+      sum += value;
+    }
+    EXPECT_NEAR(sum / 100000, 0.5, 0.005);
+  }
+}
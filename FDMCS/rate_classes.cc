@@ -0,0 +1,142 @@
+#include "rate_classes.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace {
+
+// Exponents of positive doubles lie within [-1074, 1023].
+constexpr int kClassOffset = 1074;
+constexpr int kNumClasses = kClassOffset + 1024;
+
+} // namespace
+
+
+RateClasses::RateClasses()
+    : members_(kNumClasses), sums_(kNumClasses, 0.0), min_class_(kNumClasses), max_class_(-1) {}
+
+
+int RateClasses::ClassOf(double value) {
+  return std::ilogb(value) + kClassOffset;
+}
+
+
+void RateClasses::Insert(int idx, int rate_class) {
+  class_[idx] = rate_class;
+  position_[idx] = members_[rate_class].size();
+  members_[rate_class].push_back(idx);
+  min_class_ = std::min(min_class_, rate_class);
+  max_class_ = std::max(max_class_, rate_class);
+}
+
+
+void RateClasses::Remove(int idx) {
+  std::vector<int>& members = members_[class_[idx]];
+  int moved = members.back();
+  members[position_[idx]] = moved;
+  position_[moved] = position_[idx];
+  members.pop_back();
+  class_[idx] = -1;
+}
+
+
+void RateClasses::Update(int idx, double value) {
+  if (idx >= int(values_.size())) {
+    values_.resize(idx + 1, 0.0);
+    class_.resize(idx + 1, -1);
+    position_.resize(idx + 1, 0);
+  }
+  int rate_class = value > 0 ? ClassOf(value) : -1;
+  if (class_[idx] >= 0) {
+    sums_[class_[idx]] -= values_[idx];
+  }
+  if (rate_class != class_[idx]) {
+    if (class_[idx] >= 0) {
+      Remove(idx);
+    }
+    if (rate_class >= 0) {
+      Insert(idx, rate_class);
+    }
+  }
+  if (rate_class >= 0) {
+    sums_[rate_class] += value;
+  }
+  values_[idx] = value;
+}
+
+
+void RateClasses::Sync(const double* leaves, int size) {
+  for (int idx = size; idx < int(values_.size()); idx++) {
+    if (class_[idx] >= 0) {
+      Remove(idx);
+    }
+  }
+  values_.resize(size, 0.0);
+  class_.resize(size, -1);
+  position_.resize(size, 0);
+
+  for (int idx = 0; idx < size; idx++) {
+    double value = leaves[idx];
+    int rate_class = value > 0 ? ClassOf(value) : -1;
+    if (rate_class != class_[idx]) {
+      if (class_[idx] >= 0) {
+        Remove(idx);
+      }
+      if (rate_class >= 0) {
+        Insert(idx, rate_class);
+      }
+    }
+    values_[idx] = value;
+  }
+
+  for (int rate_class = min_class_; rate_class <= max_class_; rate_class++) {
+    double sum = 0;
+    for (int idx : members_[rate_class]) {
+      sum += values_[idx];
+    }
+    sums_[rate_class] = sum;
+  }
+  while (min_class_ <= max_class_ && members_[min_class_].empty()) {
+    min_class_++;
+  }
+  while (max_class_ >= min_class_ && members_[max_class_].empty()) {
+    max_class_--;
+  }
+}
+
+
+double RateClasses::Total() const {
+  double total = 0;
+  for (int rate_class = min_class_; rate_class <= max_class_; rate_class++) {
+    total += sums_[rate_class];
+  }
+  return total;
+}
+
+
+int RateClasses::Find(double rate, RandomEngine* rng) const {
+  int chosen = -1;
+  for (int rate_class = min_class_; rate_class <= max_class_; rate_class++) {
+    if (members_[rate_class].empty()) {
+      continue;
+    }
+    chosen = rate_class;
+    if (rate < sums_[rate_class]) {
+      break;
+    }
+    rate -= sums_[rate_class];
+  }
+  if (chosen < 0) {
+    return -1;
+  }
+
+  const std::vector<int>& members = members_[chosen];
+  double bound = std::ldexp(1.0, chosen - kClassOffset + 1);
+  while (true) {
+    int idx = members[std::min<int>(rng->Uniform() * members.size(), members.size() - 1)];
+    if (rng->Uniform() * bound < values_[idx]) {
+      return idx;
+    }
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef FDMCS_RATE_CLASSES
+#define FDMCS_RATE_CLASSES
+
+#include <vector>
+
+#include "random_engine.h"
+
+// Composition-rejection sampler over non-negative group rates.
+//
+// Leaves are grouped into classes of rates within [2^c, 2^(c+1)). A draw
+// picks a class proportionally to its sum by scanning the occupied classes,
+// then a uniform member of the class that is accepted with probability
+// rate / 2^(c+1), which is at least 1/2. Sampling costs O(number of
+// classes) plus O(1) expected rejections, and changing a leaf costs O(1).
+class RateClasses {
+ public:
+  RateClasses();
+
+  // Sets the value of a leaf, moving it between classes if needed.
+  void Update(int idx, double value);
+
+  // Brings the classes in sync with the first `size` leaves and recomputes
+  // the class sums, so they do not accumulate rounding errors. Leaves past
+  // `size` are dropped.
+  void Sync(const double* leaves, int size);
+
+  inline double Leaf(int idx) const { return values_[idx]; }
+
+  double Total() const;
+
+  // Draws a leaf proportionally to its value. `rate` in [0, Total()) picks
+  // the class and `rng` drives the rejection inside of it. Rates past the
+  // total pick the last occupied class. Returns -1 if all leaves are zero.
+  int Find(double rate, RandomEngine* rng) const;
+
+ private:
+  // Class of a positive value, offset so that all doubles map to [0, kNumClasses).
+  static int ClassOf(double value);
+
+  void Insert(int idx, int rate_class);
+  void Remove(int idx);
+
+  std::vector<double> values_;
+  // Class of every leaf, -1 for zero leaves.
+  std::vector<int> class_;
+  // Position of every leaf inside of its class.
+  std::vector<int> position_;
+  std::vector<std::vector<int>> members_;
+  std::vector<double> sums_;
+  // Inclusive range of classes that may be occupied.
+  int min_class_;
+  int max_class_;
+};
+
+#endif
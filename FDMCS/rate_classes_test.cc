@@ -0,0 +1,62 @@
+#include "rate_classes.h"
+
+#include <random>
+
+#include "gtest/gtest.h"
+
+
+TEST(RateClassesTest, UpdateKeepsTotal) {
+  RateClasses classes;
+  classes.Update(0, 1.0);
+  classes.Update(3, 2.5);
+  classes.Update(4, 0.5);
+  EXPECT_DOUBLE_EQ(classes.Total(), 4.0);
+
+  classes.Update(3, 3.0);
+  EXPECT_DOUBLE_EQ(classes.Total(), 4.5);
+  classes.Update(3, 0.0);
+  EXPECT_DOUBLE_EQ(classes.Total(), 1.5);
+}
+
+TEST(RateClassesTest, SyncDropsLeavesPastSize) {
+  RateClasses classes;
+  std::vector<double> leaves{0.0, 1.0, 2.0, 1000.0};
+  classes.Sync(leaves.data(), 4);
+  EXPECT_DOUBLE_EQ(classes.Total(), 1003.0);
+
+  leaves[1] = 4.0;
+  classes.Sync(leaves.data(), 3);
+  EXPECT_DOUBLE_EQ(classes.Total(), 6.0);
+  EXPECT_EQ(classes.Leaf(1), 4.0);
+}
+
+TEST(RateClassesTest, FindReturnsNothingWhenEmpty) {
+  RateClasses classes;
+  RandomEngine rng;
+  EXPECT_EQ(classes.Find(0.0, &rng), -1);
+
+  classes.Update(2, 1.0);
+  classes.Update(2, 0.0);
+  EXPECT_EQ(classes.Find(0.0, &rng), -1);
+}
+
+TEST(RateClassesTest, FindDrawsProportionallyToLeaves) {
+  RateClasses classes;
+  std::vector<double> leaves{0.0, 1.0, 1.5, 3.0, 1e6, 5e-7};
+  classes.Sync(leaves.data(), leaves.size());
+  double total = classes.Total();
+
+  const int num_draws = 1'000'000;
+  RandomEngine rng;
+  std::uniform_real_distribution<double> rate_dist(0, total);
+  std::vector<int> hits(leaves.size(), 0);
+  for (int i = 0; i < num_draws; i++) {
+    hits[classes.Find(rate_dist(rng), &rng)]++;
+  }
+
+  EXPECT_EQ(hits[0], 0);
+  for (size_t idx = 1; idx < leaves.size(); idx++) {
+    double expected = num_draws * leaves[idx] / total;
+    EXPECT_NEAR(hits[idx], expected, 5 * std::sqrt(expected) + 1) << "leaf " << idx;
+  }
+}
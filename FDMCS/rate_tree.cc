@@ -0,0 +1,91 @@
+#include "rate_tree.h"
+
+#include <algorithm>
+
+
+RateTree::RateTree() : capacity_(1), tree_(2, 0.0) {}
+
+
+void RateTree::Reserve(int size) {
+  if (size <= capacity_) {
+    return;
+  }
+  int capacity = capacity_;
+  while (capacity < size) {
+    capacity *= 2;
+  }
+
+  std::vector<double> tree(2 * capacity, 0.0);
+  std::copy(tree_.begin() + capacity_, tree_.end(), tree.begin() + capacity);
+  tree_.swap(tree);
+  capacity_ = capacity;
+  Rebuild(capacity_);
+}
+
+
+void RateTree::Update(int idx, double value) {
+  int node = capacity_ + idx;
+  tree_[node] = value;
+  for (node /= 2; node >= 1; node /= 2) {
+    tree_[node] = tree_[2 * node] + tree_[2 * node + 1];
+  }
+}
+
+
+void RateTree::Rebuild(int size, int height) {
+  int first = capacity_ >> height;
+  int last = (capacity_ + std::max(size, 1) - 1) >> height;
+  while (first > 1) {
+    first /= 2;
+    last /= 2;
+    for (int node = first; node <= last; node++) {
+      tree_[node] = tree_[2 * node] + tree_[2 * node + 1];
+    }
+  }
+}
+
+
+void RateTree::RebuildSubtrees(int first, int last, int height) {
+  if (first >= last) {
+    return;
+  }
+  int first_node = capacity_ + first;
+  int last_node = capacity_ + last - 1;
+  for (int level = 0; level < height && first_node > 1; level++) {
+    first_node /= 2;
+    last_node /= 2;
+    for (int node = first_node; node <= last_node; node++) {
+      tree_[node] = tree_[2 * node] + tree_[2 * node + 1];
+    }
+  }
+}
+
+
+double RateTree::Prefix(int idx) const {
+  if (idx >= capacity_) {
+    return Total();
+  }
+  double sum = 0;
+  for (int node = capacity_ + idx; node > 1; node /= 2) {
+    if (node % 2 == 1) {
+      sum += tree_[node - 1];
+    }
+  }
+  return sum;
+}
+
+
+int RateTree::Find(double* rate) const {
+  int node = 1;
+  while (node < capacity_) {
+    int left = 2 * node;
+    bool go_left = *rate < tree_[left] && tree_[left] > 0;
+    if (go_left || tree_[left + 1] <= 0) {
+      node = left;
+    } else {
+      *rate -= tree_[left];
+      node = left + 1;
+    }
+  }
+  return node - capacity_;
+}
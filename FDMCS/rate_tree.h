@@ -0,0 +1,62 @@
+#ifndef FDMCS_RATE_TREE
+#define FDMCS_RATE_TREE
+
+#include <vector>
+
+// Binary sum tree over non-negative group rates.
+//
+// Leaves are addressed by particle index, every inner node holds the sum of
+// its two children and the root holds the total rate. Point updates and
+// searches cost O(log N), reading the total costs O(1).
+class RateTree {
+ public:
+  RateTree();
+
+  // Makes room for at least `size` leaves. New leaves are zero.
+  void Reserve(int size);
+
+  // Sets the value of a leaf and updates all of its ancestors.
+  void Update(int idx, double value);
+
+  // Sets the value of a leaf without updating its ancestors. Used by the O(N)
+  // rate-update loops, which call Rebuild once they are done.
+  inline void SetLeaf(int idx, double value) { tree_[capacity_ + idx] = value; }
+
+  // Recomputes all inner nodes above the first `size` leaves in O(size).
+  // With `height` > 0, nodes of the lowest `height` levels are taken as they
+  // are, see RebuildSubtrees.
+  void Rebuild(int size, int height = 0);
+
+  // Recomputes the inner nodes of the lowest `height` levels above leaves
+  // [first, last), where `first` is a multiple of 2^height. Calls for
+  // disjoint ranges may run concurrently. Followed by Rebuild(size, height),
+  // it yields the same tree as Rebuild(size).
+  void RebuildSubtrees(int first, int last, int height);
+
+  inline double Leaf(int idx) const { return tree_[capacity_ + idx]; }
+
+  // Contiguous leaf storage for the rate-update loops, same contract as
+  // SetLeaf. Invalidated by Reserve.
+  inline double* MutableLeaves() { return tree_.data() + capacity_; }
+  inline const double* Leaves() const { return tree_.data() + capacity_; }
+
+  inline double Total() const { return tree_[1]; }
+
+  // Number of leaves the tree has room for. Trees with equal capacity and
+  // leaves hold bit-identical sums.
+  inline int Capacity() const { return capacity_; }
+
+  // Returns the sum of the first `idx` leaves.
+  double Prefix(int idx) const;
+
+  // Finds the leaf whose cumulative rate interval contains `rate` and reduces
+  // `rate` to the offset inside of that leaf. Rates outside of [0, Total())
+  // are clamped to the first or the last non-empty leaf.
+  int Find(double* rate) const;
+
+ private:
+  int capacity_;
+  std::vector<double> tree_;
+};
+
+#endif
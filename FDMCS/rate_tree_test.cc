@@ -0,0 +1,101 @@
+#include "rate_tree.h"
+
+#include "gtest/gtest.h"
+
+
+TEST(RateTreeTest, UpdateKeepsTotal) {
+  RateTree tree;
+  tree.Reserve(5);
+  tree.Update(0, 1.0);
+  tree.Update(3, 2.5);
+  tree.Update(4, 0.5);
+  EXPECT_DOUBLE_EQ(tree.Total(), 4.0);
+
+  tree.Update(3, 0.0);
+  EXPECT_DOUBLE_EQ(tree.Total(), 1.5);
+}
+
+TEST(RateTreeTest, RebuildAfterSetLeaf) {
+  RateTree tree;
+  tree.Reserve(6);
+  for (int i = 0; i < 6; i++) {
+    tree.SetLeaf(i, i);
+  }
+  tree.Rebuild(6);
+  EXPECT_DOUBLE_EQ(tree.Total(), 15.0);
+}
+
+TEST(RateTreeTest, PrefixSumsLeadingLeaves) {
+  RateTree tree;
+  tree.Reserve(8);
+  for (int i = 0; i < 8; i++) {
+    tree.Update(i, i + 1);
+  }
+  EXPECT_DOUBLE_EQ(tree.Prefix(0), 0.0);
+  EXPECT_DOUBLE_EQ(tree.Prefix(3), 6.0);
+  EXPECT_DOUBLE_EQ(tree.Prefix(8), 36.0);
+}
+
+TEST(RateTreeTest, FindReturnsLeafAndOffset) {
+  RateTree tree;
+  tree.Reserve(4);
+  tree.Update(0, 1.0);
+  tree.Update(2, 2.0);
+  tree.Update(3, 3.0);
+
+  double rate = 0.5;
+  EXPECT_EQ(tree.Find(&rate), 0);
+  EXPECT_DOUBLE_EQ(rate, 0.5);
+
+  rate = 1.5;
+  EXPECT_EQ(tree.Find(&rate), 2);
+  EXPECT_DOUBLE_EQ(rate, 0.5);
+
+  rate = 4.0;
+  EXPECT_EQ(tree.Find(&rate), 3);
+  EXPECT_DOUBLE_EQ(rate, 1.0);
+}
+
+TEST(RateTreeTest, FindSkipsEmptyLeaves) {
+  RateTree tree;
+  tree.Reserve(8);
+  tree.Update(5, 1.0);
+
+  double rate = 0.0;
+  EXPECT_EQ(tree.Find(&rate), 5);
+
+  rate = 10.0;
+  EXPECT_EQ(tree.Find(&rate), 5);
+}
+
+TEST(RateTreeTest, ReserveKeepsLeaves) {
+  RateTree tree;
+  tree.Reserve(2);
+  tree.Update(1, 3.0);
+  tree.Reserve(100);
+  tree.Update(99, 1.0);
+
+  EXPECT_DOUBLE_EQ(tree.Leaf(1), 3.0);
+  EXPECT_DOUBLE_EQ(tree.Total(), 4.0);
+}
+
+TEST(RateTreeTest, RebuildSubtreesMatchesRebuild) {
+  RateTree full;
+  RateTree split;
+  full.Reserve(100);
+  split.Reserve(100);
+  for (int i = 0; i < 100; i++) {
+    full.SetLeaf(i, 0.1 * i + 1.0 / (i + 1));
+    split.SetLeaf(i, 0.1 * i + 1.0 / (i + 1));
+  }
+  full.Rebuild(100);
+  split.RebuildSubtrees(0, 32, /*height=*/5);
+  split.RebuildSubtrees(32, 64, /*height=*/5);
+  split.RebuildSubtrees(64, 100, /*height=*/5);
+  split.Rebuild(100, /*height=*/5);
+
+  EXPECT_EQ(split.Total(), full.Total());
+  for (int i = 0; i <= 100; i += 7) {
+    EXPECT_EQ(split.Prefix(i), full.Prefix(i));
+  }
+}
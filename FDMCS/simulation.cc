@@ -2,142 +2,495 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
 #include <random>
+#include <sstream>
 
 
-Simulation::Simulation() : Simulation(0, std::mt19937{}) {}
+Simulation::Simulation() : Simulation(0, RandomEngine()) {}
 
 
-Simulation::Simulation(float fragmentation_rate, std::mt19937 rng)
-    : total_rate(0),
+Simulation::Simulation(float fragmentation_rate, RandomEngine rng)
+    : occupied_sizes(kNumSmallParticles),
       total_size(0),
+      kernel_table(std::make_shared<KernelTable>()),
+      parallel_threshold(0),
       num_particles(0),
       num_initial_particles(0),
       max_num_particles(0),
+      first_moment(0),
+      second_moment(0),
       rng(rng),
       cell_size(1.0),
       fragmentation_rate(fragmentation_rate),
-      step_counter(0) {
+      step_counter(0),
+      validation_level(ValidationLevel::kOff),
+      validation_interval(1),
+      pair_selection(PairSelection::kExact),
+      first_sampler(FirstSampler::kSumTree),
+      second_sampler(SecondSampler::kScan),
+      size_classes(kNumSmallParticles),
+      num_bounded_classes(0) {
   for (int i = 0; i < kNumSmallParticles; i++) {
-    small_particles[i] = Particle{0, i, 0};
+    small_groups.Append(Particle{0, i, 0});
   }
-}
-
-BrownianKernelSimulation::BrownianKernelSimulation(double alpha) : alpha_(alpha) {}
-
-BrownianKernelSimulation::BrownianKernelSimulation(float fragmentation_rate, std::mt19937 rng, double alpha) : Simulation(fragmentation_rate, rng) {
-  alpha_ = alpha;
+  rate_tree.Reserve(kNumSmallParticles);
 }
 
 
 
 std::vector<Particle> Simulation::GetDistribution() {
   std::vector<Particle> result;
-  Particle particle;
-  for (int i = 0; i < total_size; i++) {
-    particle = GetParticle(i);
+  auto append = [&](Particle particle) {
     if (particle.count != 0) {
+      if (pair_selection == PairSelection::kLowRank) {
+        particle.collision_rate = LowRankCollisionRate(particle.size);
+      }
       result.push_back(particle);
     }
+  };
+  occupied_sizes.ForEachRange([&](int begin, int end) {
+    for (int idx = begin; idx < end; idx++) {
+      append(small_groups.Get(idx));
+    }
+  });
+  for (int slot = 0; slot < big_groups.Size(); slot++) {
+    append(big_groups.Get(slot));
   }
   return result;
 }
 
 
+void Simulation::SaveState(SimulationState* state) const {
+  state->pair_selection = pair_selection;
+  state->fragmentation_rate = fragmentation_rate;
+  state->step_counter = step_counter;
+  state->total_rate = pair_selection == PairSelection::kExact ? CountTotalRate() : 0;
+  state->cell_size = cell_size;
+  state->num_particles = num_particles;
+  state->num_initial_particles = num_initial_particles;
+  state->max_num_particles = max_num_particles;
+  state->total_size = total_size;
+  state->rate_tree_capacity = rate_tree.Capacity();
+
+  int num_small = SmallExtent();
+  state->small_groups.counts.assign(small_groups.counts.begin(),
+                                    small_groups.counts.begin() + num_small);
+  state->small_groups.sizes.assign(small_groups.sizes.begin(),
+                                   small_groups.sizes.begin() + num_small);
+  state->small_groups.collision_rates.assign(small_groups.collision_rates.begin(),
+                                             small_groups.collision_rates.begin() + num_small);
+  state->big_groups = big_groups;
+
+  state->big_class_positions.clear();
+  state->class_bounds.clear();
+  state->class_rates.clear();
+  state->num_bounded_classes = 0;
+  if (TracksSizeClasses()) {
+    for (int slot = 0; slot < big_groups.Size(); slot++) {
+      state->big_class_positions.push_back(size_classes.BigPosition(slot));
+    }
+    state->num_bounded_classes = num_bounded_classes;
+    for (int first = 0; first < num_bounded_classes; first++) {
+      for (int second = 0; second < num_bounded_classes; second++) {
+        state->class_bounds.push_back(class_bounds[first][second]);
+      }
+      state->class_rates.push_back(class_rates[first]);
+    }
+  }
+  state->factor_tree_capacity = self_rate_tree.Capacity();
+
+  state->rng = rng.Serialize();
+}
+
+
+void Simulation::RestoreState(const SimulationState& state) {
+  assert(num_particles == 0);
+  SetPairSelection(state.pair_selection);
+  fragmentation_rate = state.fragmentation_rate;
+  step_counter = state.step_counter;
+  cell_size = state.cell_size;
+  num_particles = state.num_particles;
+  num_initial_particles = state.num_initial_particles;
+  max_num_particles = state.max_num_particles;
+
+  std::copy(state.small_groups.counts.begin(), state.small_groups.counts.end(),
+            small_groups.counts.begin());
+  std::copy(state.small_groups.collision_rates.begin(), state.small_groups.collision_rates.end(),
+            small_groups.collision_rates.begin());
+  big_groups = ParticleGroups();
+  for (int slot = 0; slot < state.big_groups.Size(); slot++) {
+    Particle particle = state.big_groups.Get(slot);
+    big_groups.Append(particle, SizeFeatures(particle.size));
+    big_slots.try_emplace(particle.size, slot);
+  }
+  for (int idx = 1; idx < state.small_groups.Size(); idx++) {
+    if (small_groups.counts[idx] > 0) {
+      small_groups.SetFeatures(idx, SizeFeatures(idx));
+      occupied_sizes.Insert(idx);
+    }
+  }
+  UpdateTotalSize();
+  RecountMoments();
+
+  // Leaves are set exactly the way the update loops set them, so the sums
+  // match the saved tree.
+  rate_tree.Reserve(state.rate_tree_capacity);
+  for (int idx = 0; idx < SmallExtent(); idx++) {
+    rate_tree.SetLeaf(idx, small_groups.collision_rates[idx] * small_groups.counts[idx]);
+  }
+  for (int slot = 0; slot < big_groups.Size(); slot++) {
+    rate_tree.SetLeaf(kNumSmallParticles + slot,
+                      big_groups.collision_rates[slot] * big_groups.counts[slot]);
+  }
+  RebuildRates();
+
+  if (TracksSizeClasses()) {
+    for (int idx = 1; idx < SmallExtent(); idx++) {
+      if (small_groups.counts[idx] > 0) {
+        size_classes.AddSmall(idx, small_groups.counts[idx]);
+      }
+    }
+    for (int slot = 0; slot < big_groups.Size(); slot++) {
+      size_classes.AddBig(big_groups.sizes[slot], big_groups.counts[slot]);
+    }
+    if (state.num_bounded_classes > 0) {
+      size_classes.RestoreBigPositions(state.big_class_positions);
+      num_bounded_classes = state.num_bounded_classes;
+      for (int first = 0; first < num_bounded_classes; first++) {
+        for (int second = 0; second < num_bounded_classes; second++) {
+          class_bounds[first][second] = state.class_bounds[first * num_bounded_classes + second];
+        }
+        class_rates[first] = state.class_rates[first];
+      }
+    } else if (size_classes.NumClasses() > 0) {
+      // Saved by a run that did not track size classes, so the class rates
+      // are counted from scratch.
+      UpdateClassCount(size_classes.NumClasses() - 1, 0);
+    }
+  }
+
+  if (pair_selection == PairSelection::kLowRank) {
+    for (auto& tree : factor_trees) {
+      tree.Reserve(state.factor_tree_capacity);
+    }
+    self_rate_tree.Reserve(state.factor_tree_capacity);
+    for (int idx = 1; idx < total_size; idx++) {
+      UpdateFactorLeaves(idx);
+    }
+  }
+
+  // States without an engine keep the current one.
+  rng.Deserialize(state.rng);
+}
+
+
 double Simulation::RunSimulationStep() {
   // Remember the number of initial particles before doing any work.
   if (num_initial_particles == 0) {
     num_initial_particles = max_num_particles;
   }
-  std::uniform_real_distribution<double> pair_dist(0, total_rate);
-  std::uniform_real_distribution<double> frag_dist(0, 1.0 + fragmentation_rate);
-  double rate = pair_dist(rng);
-  bool is_aggr = frag_dist(rng) < 1;
-
-  const std::pair<int, int> particles = FindPair(rate);
-  long long new_size =
-      GetParticle(particles.first).size + GetParticle(particles.second).size;
-  if (is_aggr) {
-    AddParticle(new_size);
+  bool validate = validation_level != ValidationLevel::kOff &&
+                  step_counter % validation_interval == 0;
+  long long mass = validate ? CountMass() : 0;
+  // The time increment is drawn from the rate before the event, which also
+  // covers rejected draws of the majorant selection.
+  double event_rate = EventRate();
+  double rate = rng.Uniform() * event_rate;
+  bool is_aggr = rng.Uniform() * (1.0 + fragmentation_rate) < 1;
+
+  std::pair<int, int> particles;
+  bool accepted = true;
+  if (pair_selection == PairSelection::kMajorant) {
+    ScopedPhase scoped_phase(&profile, Phase::kFindMajorantPair);
+    accepted = FindMajorantPair(rate, &particles);
+  } else if (pair_selection == PairSelection::kLowRank) {
+    ScopedPhase scoped_phase(&profile, Phase::kFindLowRankPair);
+    accepted = FindLowRankPair(&particles);
   } else {
-    AddMonomers(new_size);
+    particles = FindPair(rate);
+  }
+  if (accepted) {
+    long long new_size =
+        GetParticle(particles.first).size + GetParticle(particles.second).size;
+    if (is_aggr) {
+      profile.CountEvent(Event::kAggregation);
+      AddParticle(new_size);
+    } else {
+      profile.CountEvent(Event::kFragmentation);
+      AddMonomers(new_size);
+    }
+    DeletePair(particles);
+  } else {
+    profile.CountEvent(Event::kRejection);
   }
-  DeletePair(particles);
 
-  if (step_counter % 1000  == 0) {
-    total_rate = CountTotalRate();
+  if (step_counter % 1000  == 0 && TracksSizeClasses()) {
+    ScopedPhase scoped_phase(&profile, Phase::kCountClassRates);
+    CountClassRates();
   }
   step_counter++;
 
   if (num_particles <= (max_num_particles / 2)) {
+    profile.CountEvent(Event::kDuplication);
     DuplicateParticles();
     cell_size *= 2.0;
+    mass *= 2;
+  }
+  profile.TrackBigGroups(big_groups.Size());
+  if (validate) {
+    Validate(mass);
   }
 
-  assert(abs(CountTotalRate() - total_rate) < 1);
   double renormalization = 1 / (1.0 + fragmentation_rate);
-  return 2.0 / total_rate * renormalization * num_initial_particles * cell_size;
+  return 2.0 / event_rate * renormalization * num_initial_particles * cell_size;
+}
+
+
+double Simulation::EventRate() {
+  if (pair_selection == PairSelection::kMajorant) {
+    return CountMajorantRate();
+  }
+  if (pair_selection == PairSelection::kLowRank) {
+    return CountLowRankRate();
+  }
+  return CountTotalRate();
+}
+
+
+void Simulation::SetValidation(ValidationLevel level, int interval) {
+  validation_level = level;
+  validation_interval = std::max(interval, 1);
+}
+
+
+long long Simulation::CountMass() {
+  long long mass = 0;
+  for (const auto& particle : GetDistribution()) {
+    mass += particle.count * particle.size;
+  }
+  return mass;
+}
+
+
+void Simulation::RecountMoments() {
+  first_moment = 0;
+  second_moment = 0;
+  auto add = [&](const ParticleGroups& groups, int pos) {
+    first_moment += (long long) groups.counts[pos] * (long long) groups.sizes[pos];
+    second_moment += groups.counts[pos] * groups.sizes[pos] * groups.sizes[pos];
+  };
+  occupied_sizes.ForEachRange([&](int begin, int end) {
+    for (int idx = begin; idx < end; idx++) {
+      add(small_groups, idx);
+    }
+  });
+  for (int slot = 0; slot < big_groups.Size(); slot++) {
+    add(big_groups, slot);
+  }
+}
+
+
+std::string Simulation::CheckConsistency(ValidationLevel level) {
+  if (level == ValidationLevel::kOff) {
+    return "";
+  }
+  std::vector<Particle> particles = GetDistribution();
+  long long count = 0;
+  for (const auto& particle : particles) {
+    count += particle.count;
+  }
+  if (count != num_particles) {
+    std::ostringstream error;
+    error << "groups hold " << count << " particles, expected " << num_particles;
+    return error.str();
+  }
+  long long first = 0;
+  double second = 0;
+  for (const auto& particle : particles) {
+    first += particle.count * particle.size;
+    second += particle.count * (double) particle.size * particle.size;
+  }
+  if (first != first_moment || std::abs(second - second_moment) > 1e-12 * second) {
+    std::ostringstream error;
+    error.precision(17);
+    error << "moments are " << first_moment << " and " << second_moment << ", expected "
+          << first << " and " << second;
+    return error.str();
+  }
+  // The majorant selection keeps no collision rates.
+  if (pair_selection == PairSelection::kMajorant || particles.empty()) {
+    return "";
+  }
+
+  int begin = 0;
+  int end = particles.size();
+  if (level == ValidationLevel::kSampled) {
+    begin = (step_counter / validation_interval) % particles.size();
+    end = begin + 1;
+  }
+  for (int i = begin; i < end; i++) {
+    const Particle& particle = particles[i];
+    double expected = -CollisionFunction(particle.size, particle.size);
+    // Sum of the magnitudes of all terms, which bounds the rounding errors.
+    double scale = -expected;
+    for (const auto& partner : particles) {
+      double partner_rate = partner.count * CollisionFunction(particle.size, partner.size);
+      expected += partner_rate;
+      scale += partner_rate;
+    }
+    // Incremental updates round once each, which stays far below this
+    // tolerance for any feasible number of events.
+    if (std::abs(particle.collision_rate - expected) > 1e-6 * scale) {
+      std::ostringstream error;
+      error.precision(17);
+      error << "collision rate of size " << particle.size << " is " << particle.collision_rate
+            << ", expected " << expected;
+      return error.str();
+    }
+  }
+  return "";
+}
+
+
+void Simulation::Validate(long long expected_mass) {
+  std::string error = CheckConsistency(validation_level);
+  long long mass = CountMass();
+  if (error.empty() && mass != expected_mass) {
+    std::ostringstream message;
+    message << "mass is " << mass << ", expected " << expected_mass;
+    error = message.str();
+  }
+  if (!error.empty()) {
+    std::cerr << "Validation failed at step " << step_counter << ": " << error << std::endl;
+    std::abort();
+  }
+}
+
+
+void Simulation::SetFirstSampler(FirstSampler sampler) {
+  assert(num_particles == 0);
+  first_sampler = sampler;
+}
+
+
+void Simulation::SetSecondSampler(SecondSampler sampler) {
+  assert(num_particles == 0);
+  second_sampler = sampler;
+}
+
+
+void Simulation::SetKernelTableCutoff(int cutoff) {
+  // A new table, so that simulations sharing the old one keep it.
+  kernel_table = std::make_shared<KernelTable>();
+  kernel_table->Reset(std::min(cutoff, kNumSmallParticles));
+}
+
+
+std::shared_ptr<KernelTable> Simulation::BuiltKernelTable() {
+  if (kernel_table->Cutoff() > 0 && !kernel_table->Built()) {
+    BuildKernelTable();
+  }
+  return kernel_table;
+}
+
+
+void Simulation::ShareKernelTable(std::shared_ptr<KernelTable> table) {
+  assert(num_particles == 0);
+  kernel_table = std::move(table);
+}
+
+
+void Simulation::SetParallelism(int num_threads, int threshold) {
+  thread_pool.reset();
+  if (num_threads > 1) {
+    thread_pool = std::make_unique<ThreadPool>(num_threads);
+  }
+  parallel_threshold = threshold;
+  partial_rates.assign(std::max(num_threads, 1), 0.0);
+}
+
+
+void Simulation::SetPairSelection(PairSelection selection) {
+  assert(num_particles == 0);
+  pair_selection = selection;
+  if (pair_selection == PairSelection::kLowRank) {
+    separable_terms = SeparableTerms();
+    assert(!separable_terms.empty());
+    int num_factors = 0;
+    for (const auto& term : separable_terms) {
+      num_factors = std::max({num_factors, term.first_factor + 1, term.second_factor + 1});
+    }
+    factors.resize(num_factors);
+    factor_trees.resize(num_factors);
+    for (auto& tree : factor_trees) {
+      tree.Reserve(kNumSmallParticles);
+    }
+    self_rate_tree.Reserve(kNumSmallParticles);
+  }
 }
 
 
 void Simulation::AddParticle(long long size) {
-  double rate = 0;
-  double collision_value;
-  for (int i = 1; i < total_size; i++) {
-    Particle& particle = GetParticle(i);
-    collision_value = CollisionFunction(size, particle.size);
-    rate += collision_value * particle.count;
-    particle.collision_rate += collision_value;
+  ScopedPhase scoped_phase(&profile, Phase::kAddParticle);
+  if (pair_selection != PairSelection::kExact) {
+    InsertParticle(size, 0);
+    IncrementParticleCount(1);
+    return;
   }
+
+  double rate = UpdateCollisionRates(size, 1);
   InsertParticle(size, rate);
-  total_rate += 2 * rate;
+  RebuildRates();
   IncrementParticleCount(1);
 }
 
 
 void Simulation::AddMonomers(long long num_monomers) {
-  double rate = CollisionFunction(1, 1) * (num_monomers - 1);
-  double collision_value;
-  for (int i = 1; i < total_size; i++) {
-    Particle& particle = GetParticle(i);
-    collision_value = CollisionFunction(1, particle.size);
-    rate += collision_value * particle.count;
-    particle.collision_rate += collision_value * num_monomers;
-  }
-  if (kNumSmallParticles >= 2) {
-    InsertParticle(1, rate);
-    small_particles[1].count += (num_monomers - 1);
-  } else {
-    big_particles.reserve(big_particles.size() + num_monomers);
-    for (int i = 0; i < num_monomers; i++) {
-      InsertParticle(1, rate);
-    }
+  AddParticles(1, num_monomers);
+}
+
+
+void Simulation::AddParticles(long long size, long long count) {
+  ScopedPhase scoped_phase(&profile, Phase::kAddParticles);
+  if (count <= 0) {
+    return;
   }
-  total_rate += rate * num_monomers * 2;
-  IncrementParticleCount(num_monomers);
+  if (pair_selection != PairSelection::kExact) {
+    InsertParticles(size, count, 0);
+    IncrementParticleCount(count);
+    return;
+  }
+
+  double self_collision = CollisionFunction(size, size);
+  double rate = self_collision * (count - 1);
+  rate += UpdateCollisionRates(size, count);
+  InsertParticles(size, count, rate);
+  RebuildRates();
+  IncrementParticleCount(count);
+}
 
 
-  // Pairs of newly added monomers were double counted, so we need to fix the
-  // total rate.
-  double excess = CollisionFunction(1, 1) * num_monomers * (num_monomers - 1);
-  total_rate -= excess;
+void Simulation::AddParticles(const std::vector<Particle>& particles) {
+  for (const auto& particle : particles) {
+    AddParticles(particle.size, particle.count);
+  }
 }
 
 
 void Simulation::DeleteParticle(int idx) {
+  ScopedPhase scoped_phase(&profile, Phase::kDeleteParticle);
   Particle deleted_particle = GetParticle(idx);
   RemoveParticle(idx);
+  if (pair_selection != PairSelection::kExact) {
+    IncrementParticleCount(-1);
+    return;
+  }
 
-  double rate = 0;
-  double collision_value;
-  for (int i = 1; i < total_size; i++) {
-    Particle& particle = GetParticle(i);
-    collision_value = CollisionFunction(deleted_particle.size, particle.size);
-    rate += collision_value * particle.count;
-    particle.collision_rate -= collision_value;
-  }
-  total_rate -= 2 * rate;
+  UpdateCollisionRates(deleted_particle.size, -1);
+  RebuildRates();
   IncrementParticleCount(-1);
 }
 
@@ -153,133 +506,474 @@ void Simulation::DeletePair(const std::pair<int, int>& idxs) {
 }
 
 
+// Doubles every group in a single pass. A particle then collides with twice
+// as many partners plus its own copy, so its rate becomes
+// 2 * rate + K(size, size).
 void Simulation::DuplicateParticles() {
-  int num_sizes = total_size;
-
-  for (int idx = 1; idx < num_sizes; idx++) {
-    Particle& particle = GetParticle(idx);
-    int count = particle.count;
-    int size = particle.size;
-    if (size == 1) {
-      AddMonomers(count);
-    } else {
-      for (int j = 0; j < count; j++) {
-        AddParticle(size);
+  ScopedPhase scoped_phase(&profile, Phase::kDuplicateParticles);
+  bool is_exact = pair_selection == PairSelection::kExact;
+  // Doubles the group at position `pos` of `groups`, whose particle index is
+  // `idx`.
+  auto duplicate = [&](ParticleGroups* groups, int pos, int idx) {
+    long long count = groups->counts[pos];
+    if (count == 0) {
+      return;
+    }
+    long long size = groups->sizes[pos];
+    groups->counts[pos] += count;
+    if (is_exact) {
+      double& rate = groups->collision_rates[pos];
+      rate = 2 * rate + CollisionFunction(size, size);
+      rate_tree.SetLeaf(idx, rate * groups->counts[pos]);
+    }
+    if (TracksSizeClasses()) {
+      if (idx < kNumSmallParticles) {
+        size_classes.AddSmall(size, count);
+      } else {
+        size_classes.AddBigCount(pos, count);
       }
+      UpdateClassCount(SizeClass(size), count);
+    }
+    if (pair_selection == PairSelection::kLowRank) {
+      UpdateFactorLeaves(idx);
+    }
+  };
+
+  occupied_sizes.ForEachRange([&](int begin, int end) {
+    for (int idx = begin; idx < end; idx++) {
+      duplicate(&small_groups, idx, idx);
     }
+  });
+  for (int slot = 0; slot < big_groups.Size(); slot++) {
+    duplicate(&big_groups, slot, kNumSmallParticles + slot);
   }
-  total_rate = CountTotalRate();
+
+  RebuildRates();
+  IncrementParticleCount(num_particles);
+  first_moment *= 2;
+  second_moment *= 2;
 }
 
 
 std::pair<int, int> Simulation::FindPair(double rate) {
-  SearchResult first = FindFirst(rate);
-  SearchResult second = FindSecond(first);
+  SearchResult first;
+  {
+    ScopedPhase scoped_phase(&profile, Phase::kFindFirst);
+    first = FindFirst(rate);
+  }
+  ScopedPhase scoped_phase(&profile, Phase::kFindSecond);
+  SearchResult second = second_sampler == SecondSampler::kSizeClasses
+                            ? FindSecondBySizeClass(first.idx)
+                            : FindSecond(first);
 
   return std::pair{first.idx, second.idx};
 }
 
 
 SearchResult Simulation::FindFirst(double rate) {
-  int idx = 1;
-  int last_valid = 1;
-  Particle particle;
-  for (idx = 1; idx < total_size; idx++) {
-    particle = GetParticle(idx);
-    if (particle.count > 0) {
-      last_valid = idx;
-    }
-
-    double group_rate = particle.collision_rate * particle.count;
-    if (rate - group_rate <= 0) {
-      rate -= particle.collision_rate * int(rate / particle.collision_rate);
+  if (first_sampler == FirstSampler::kRateClasses) {
+    int idx = rate_classes.Find(rate, &rng);
+    assert(idx >= 0);
+    return SearchResult{idx, rng.Uniform() * GetParticle(idx).collision_rate};
+  }
+
+  int idx = rate_tree.Find(&rate);
+  Particle particle = GetParticle(idx);
+  rate -= particle.collision_rate * int(rate / particle.collision_rate);
+
+  return SearchResult{idx, rate};
+}
+
+
+// Draws the partner of `first` proportionally to the majorant value of the
+// class pair, then accepts it with probability K / K_majorant. Rejections only
+// redraw the partner, so the accepted partner follows the exact kernel.
+SearchResult Simulation::FindSecondBySizeClass(int first) {
+  Particle first_particle = GetParticle(first);
+  int first_class = SizeClass(first_particle.size);
+  while (true) {
+    double rate = rng.Uniform() * class_rates[first_class];
+    int second_class = -1;
+    for (int size_class = 0; size_class < num_bounded_classes; size_class++) {
+      long long count = size_classes.Count(size_class) - (size_class == first_class);
+      if (count <= 0) {
+        continue;
+      }
+      second_class = size_class;
+      double group_rate = class_bounds[first_class][size_class] * count;
+      if (rate < group_rate) {
+        break;
+      }
+      rate -= group_rate;
+    }
+    assert(second_class >= 0);
+
+    int second = size_classes.Sample(second_class, rng.Uniform());
+    while (second == first && rng.Uniform() * first_particle.count < 1) {
+      second = size_classes.Sample(second_class, rng.Uniform());
+    }
+    double collision_value = CollisionFunction(first_particle.size, GetParticle(second).size);
+    if (rng.Uniform() * class_bounds[first_class][second_class] < collision_value) {
+      return SearchResult{second, 0};
+    }
+  }
+}
+
+
+// Draws the pair from the majorant kernel: first a particle proportionally to
+// its majorant rate, then its partner proportionally to the majorant value of
+// the class pair. Returns false if the pair is rejected.
+bool Simulation::FindMajorantPair(double rate, std::pair<int, int>* pair) {
+  int first_class = -1;
+  for (int size_class = 0; size_class < num_bounded_classes; size_class++) {
+    long long count = size_classes.Count(size_class);
+    if (count == 0 || class_rates[size_class] <= 0) {
+      continue;
+    }
+    first_class = size_class;
+    double group_rate = class_rates[size_class] * count;
+    if (rate < group_rate) {
       break;
     }
     rate -= group_rate;
   }
+  if (first_class < 0) {
+    return false;
+  }
+  rate = std::fmod(rate, class_rates[first_class]);
 
-  if (idx >= total_size) {
-    std::cerr << "Out of bound search" << std::endl;
-    return SearchResult{0, rate};
+  int second_class = -1;
+  for (int size_class = 0; size_class < num_bounded_classes; size_class++) {
+    long long count = size_classes.Count(size_class) - (size_class == first_class);
+    if (count <= 0) {
+      continue;
+    }
+    second_class = size_class;
+    double group_rate = class_bounds[first_class][size_class] * count;
+    if (rate < group_rate) {
+      break;
+    }
+    rate -= group_rate;
+  }
+  if (second_class < 0) {
+    return false;
+  }
+
+  int first = size_classes.Sample(first_class, rng.Uniform());
+  int second = size_classes.Sample(second_class, rng.Uniform());
+  // Both draws may land in the same group. They represent the same particle
+  // with probability 1 / count, in which case the partner is drawn again.
+  while (second == first && rng.Uniform() * GetParticle(first).count < 1) {
+    second = size_classes.Sample(second_class, rng.Uniform());
   }
 
-  return SearchResult{last_valid, rate};
+  *pair = std::pair{first, second};
+  double collision_value = CollisionFunction(GetParticle(first).size, GetParticle(second).size);
+  return rng.Uniform() * class_bounds[first_class][second_class] < collision_value;
 }
 
 
-SearchResult Simulation::FindSecond(SearchResult first) {
-  double rate = first.remaining_rate;
-  int first_size = GetParticle(first.idx).size;
-  Particle particle;
-  double count;
-  double group_rate;
-  int idx = 1;
-  int last_valid = 1;
-  for (idx = 1; idx < total_size; idx++) {
-    particle = GetParticle(idx);
-    count = particle.count;
-    if (idx == first.idx) {
-      count -= 1;
+double Simulation::CountMajorantRate() {
+  double rate = 0;
+  for (int size_class = 0; size_class < num_bounded_classes; size_class++) {
+    rate += class_rates[size_class] * size_classes.Count(size_class);
+  }
+  return rate;
+}
+
+
+// Keeps class rates in sync after `delta` particles of `size_class` have been
+// registered in size_classes.
+void Simulation::UpdateClassCount(int size_class, long long delta) {
+  if (size_class >= num_bounded_classes) {
+    for (int first = 0; first <= size_class; first++) {
+      for (int second = 0; second <= size_class; second++) {
+        if (first < num_bounded_classes && second < num_bounded_classes) {
+          continue;
+        }
+        class_bounds[first][second] = CollisionBound(
+            SizeClassMin(first), SizeClassMax(first),
+            SizeClassMin(second), SizeClassMax(second));
+      }
     }
-    if (count > 0) {
-      last_valid = idx;
+    num_bounded_classes = size_class + 1;
+    CountClassRates();
+    return;
+  }
+
+  for (int other = 0; other < num_bounded_classes; other++) {
+    class_rates[other] += class_bounds[other][size_class] * delta;
+  }
+}
+
+
+void Simulation::CountClassRates() {
+  for (int first = 0; first < num_bounded_classes; first++) {
+    // A particle does not collide with itself.
+    double rate = -class_bounds[first][first];
+    for (int second = 0; second < num_bounded_classes; second++) {
+      rate += class_bounds[first][second] * size_classes.Count(second);
     }
+    class_rates[first] = rate;
+  }
+}
 
 
-    group_rate = CollisionFunction(first_size, particle.size) * count;
-    if (rate - group_rate <= 0) {
-      break;
+// Picks a kernel term proportionally to its weight, then both particles
+// proportionally to the term factors. Draws of the same particle twice are
+// repeated.
+bool Simulation::FindLowRankPair(std::pair<int, int>* pair) {
+  if (num_particles < 2) {
+    return false;
+  }
+  while (true) {
+    double total_weight = 0;
+    for (const auto& term : separable_terms) {
+      total_weight += factor_trees[term.first_factor].Total() *
+                      factor_trees[term.second_factor].Total();
     }
-    rate -= group_rate;
+    double rate = rng.Uniform() * total_weight;
+    SeparableTerm term = separable_terms.back();
+    for (const auto& candidate : separable_terms) {
+      double weight = factor_trees[candidate.first_factor].Total() *
+                      factor_trees[candidate.second_factor].Total();
+      if (rate < weight) {
+        term = candidate;
+        break;
+      }
+      rate -= weight;
+    }
+
+    const RateTree& first_tree = factor_trees[term.first_factor];
+    const RateTree& second_tree = factor_trees[term.second_factor];
+    double first_rate = rng.Uniform() * first_tree.Total();
+    double second_rate = rng.Uniform() * second_tree.Total();
+    int first = first_tree.Find(&first_rate);
+    int second = second_tree.Find(&second_rate);
+    if (first == second && rng.Uniform() * GetParticle(first).count < 1) {
+      continue;
+    }
+    *pair = std::pair{first, second};
+    return true;
   }
+}
+
 
-  return SearchResult{last_valid, rate};
+double Simulation::CountLowRankRate() {
+  double rate = -self_rate_tree.Total();
+  for (const auto& term : separable_terms) {
+    rate += factor_trees[term.first_factor].Total() *
+            factor_trees[term.second_factor].Total();
+  }
+  return rate;
+}
+
+
+double Simulation::LowRankCollisionRate(long long size) {
+  SeparableFactors(size, factors.data());
+  double rate = -CollisionFunction(size, size);
+  for (const auto& term : separable_terms) {
+    rate += factors[term.first_factor] * factor_trees[term.second_factor].Total();
+  }
+  return rate;
 }
 
 
-Particle& Simulation::GetParticle(int idx) {
+// Refreshes the weights of the group at `idx`. Indices past the end of the
+// particles are cleared.
+void Simulation::UpdateFactorLeaves(int idx) {
+  for (auto& tree : factor_trees) {
+    tree.Reserve(idx + 1);
+  }
+  self_rate_tree.Reserve(idx + 1);
+
+  if (idx >= total_size) {
+    for (auto& tree : factor_trees) {
+      tree.Update(idx, 0);
+    }
+    self_rate_tree.Update(idx, 0);
+    return;
+  }
+
+  Particle particle = GetParticle(idx);
+  SeparableFactors(particle.size, factors.data());
+  for (size_t factor = 0; factor < factors.size(); factor++) {
+    factor_trees[factor].Update(idx, particle.count * factors[factor]);
+  }
+  self_rate_tree.Update(idx, particle.count * CollisionFunction(particle.size, particle.size));
+}
+
+
+Particle Simulation::GetParticle(int idx) {
   if (idx < kNumSmallParticles) {
-    return small_particles[idx];
+    return small_groups.Get(idx);
   }
-  return big_particles[idx - kNumSmallParticles];
+  return big_groups.Get(idx - kNumSmallParticles);
 }
 
 
 void Simulation::InsertParticle(long long size, double rate) {
+  InsertParticles(size, 1, rate);
+}
+
+
+void Simulation::InsertParticles(long long size, long long count, double rate) {
+  int idx = size;
+  bool is_new_group = false;
+  first_moment += count * size;
+  second_moment += count * (double) size * size;
   if (size < kNumSmallParticles) {
-    small_particles[size].count += 1;
-    small_particles[size].collision_rate = rate;
-    total_size = std::max(total_size, size + 1);
+    if (small_groups.counts[size] == 0) {
+      small_groups.SetFeatures(size, SizeFeatures(size));
+    }
+    small_groups.counts[size] += count;
+    small_groups.collision_rates[size] = rate;
+    occupied_sizes.Insert(size);
+    UpdateTotalSize();
+    rate_tree.SetLeaf(size, rate * small_groups.counts[size]);
   } else {
-    Particle particle{1, size, rate};
-    big_particles.push_back(particle);
-    total_size = kNumSmallParticles + big_particles.size();
+    auto [slot_it, inserted] = big_slots.try_emplace(size, big_groups.Size());
+    int slot = slot_it->second;
+    is_new_group = inserted;
+    if (is_new_group) {
+      big_groups.Append(Particle{count, size, rate}, SizeFeatures(size));
+      UpdateTotalSize();
+      rate_tree.Reserve(total_size);
+    } else {
+      big_groups.counts[slot] += count;
+      big_groups.collision_rates[slot] = rate;
+    }
+    idx = kNumSmallParticles + slot;
+    rate_tree.SetLeaf(idx, rate * big_groups.counts[slot]);
+  }
+
+  if (TracksSizeClasses()) {
+    if (size < kNumSmallParticles) {
+      size_classes.AddSmall(size, count);
+    } else if (is_new_group) {
+      size_classes.AddBig(size, count);
+    } else {
+      size_classes.AddBigCount(idx - kNumSmallParticles, count);
+    }
+    UpdateClassCount(SizeClass(size), count);
+  }
+  if (pair_selection == PairSelection::kLowRank) {
+    UpdateFactorLeaves(idx);
   }
 }
 
 
 void Simulation::RemoveParticle(int idx) {
+  Particle removed = GetParticle(idx);
+  first_moment -= removed.size;
+  second_moment -= (double) removed.size * removed.size;
+  if (TracksSizeClasses()) {
+    if (idx < kNumSmallParticles) {
+      size_classes.RemoveSmall(removed.size, 1);
+    } else if (removed.count > 1) {
+      size_classes.AddBigCount(idx - kNumSmallParticles, -1);
+    } else {
+      size_classes.RemoveBig(idx - kNumSmallParticles);
+    }
+    UpdateClassCount(SizeClass(removed.size), -1);
+  }
+
+  int vacated = -1;
   if (idx < kNumSmallParticles) {
-    small_particles[idx].count -= 1;
+    small_groups.counts[idx] -= 1;
+    if (small_groups.counts[idx] > 0) {
+      rate_tree.SetLeaf(idx, small_groups.collision_rates[idx] * small_groups.counts[idx]);
+    } else {
+      // The emptied group may lie past the shrunk total size, which the
+      // rebuild does not reach.
+      occupied_sizes.Erase(idx);
+      UpdateTotalSize();
+      rate_tree.Update(idx, 0);
+    }
+  } else if (removed.count > 1) {
+    int slot = idx - kNumSmallParticles;
+    big_groups.counts[slot] -= 1;
+    rate_tree.SetLeaf(idx, big_groups.collision_rates[slot] * big_groups.counts[slot]);
   } else {
-    idx -= kNumSmallParticles;
-    std::swap(big_particles[idx], big_particles.back());
-    big_particles.pop_back();
-    total_size = kNumSmallParticles + big_particles.size();
+    RemoveBigGroup(idx - kNumSmallParticles);
+    vacated = kNumSmallParticles + big_groups.Size();
+    UpdateTotalSize();
+    if (idx < vacated) {
+      Particle moved = GetParticle(idx);
+      rate_tree.SetLeaf(idx, moved.collision_rate * moved.count);
+    }
+    // The vacated leaf lies outside of the rebuilt range, so it has to be
+    // propagated right away.
+    rate_tree.Update(vacated, 0);
+  }
+
+  if (pair_selection == PairSelection::kLowRank) {
+    UpdateFactorLeaves(idx);
+    if (vacated >= 0) {
+      UpdateFactorLeaves(vacated);
+    }
   }
 }
 
-void Simulation::IncrementParticleCount(int increment) {
+
+void Simulation::RemoveBigGroup(int slot) {
+  long long size = big_groups.sizes[slot];
+  assert(big_slots.at(size) == slot);
+  big_slots.erase(size);
+  int last = big_groups.Size() - 1;
+  if (slot != last) {
+    big_slots.at(big_groups.sizes[last]) = slot;
+  }
+  big_groups.SwapRemove(slot);
+}
+
+
+void Simulation::IncrementParticleCount(long long increment) {
   num_particles += increment;
   max_num_particles = std::max(max_num_particles, num_particles);
 }
 
 
-double Simulation::CountTotalRate() {
-  double rate = 0;
-  for (int i = 0; i < total_size; i++) {
-    Particle& particle = GetParticle(i);
-    rate += particle.collision_rate * particle.count;
+void Simulation::UpdateTotalSize() {
+  if (big_groups.Size() > 0) {
+    total_size = kNumSmallParticles + big_groups.Size();
+  } else {
+    total_size = occupied_sizes.Extent();
+  }
+}
+
+
+void Simulation::RebuildRates() {
+  if (RunsParallel()) {
+    // Every thread rebuilds whole subtrees of 2^height leaves, the levels
+    // above them are rebuilt serially.
+    int num_threads = thread_pool->NumThreads();
+    int height = 0;
+    while ((2LL << height) * num_threads <= total_size) {
+      height++;
+    }
+    int num_subtrees = (total_size + (1 << height) - 1) >> height;
+    thread_pool->Run([&](int thread) {
+      long long first = (long long) SplitPoint(num_subtrees, thread, num_threads) << height;
+      long long last = (long long) SplitPoint(num_subtrees, thread + 1, num_threads) << height;
+      rate_tree.RebuildSubtrees(first, std::min<long long>(last, total_size), height);
+    });
+    rate_tree.Rebuild(total_size, height);
+  } else {
+    rate_tree.Rebuild(total_size);
+  }
+  if (first_sampler == FirstSampler::kRateClasses) {
+    rate_classes.Sync(rate_tree.Leaves(), total_size);
   }
-  return rate;
 }
+
+
+double Simulation::CountTotalRate() const {
+  return rate_tree.Total();
+}
+
+
+template class KernelSimulation<ConstantKernel>;
+template class KernelSimulation<MultiplicationKernel>;
+template class KernelSimulation<BallisticKernel>;
+template class KernelSimulation<BrownianKernel>;
@@ -1,11 +1,38 @@
 #ifndef FDMCS_SIMULATION
 #define FDMCS_SIMULATION
 
+#include <memory>
 #include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 #include <array>
 #include <cmath>
+#include <algorithm>
+
+#include "kernel_table.h"
+#include "kernels.h"
+#include "occupied_sizes.h"
+#include "profile.h"
+#include "random_engine.h"
+#include "rate_classes.h"
+#include "rate_tree.h"
+#include "size_classes.h"
+#include "thread_pool.h"
+
+// `omp simd` with the given clauses on the loop that follows. Only
+// simulation_lib builds with -fopenmp-simd and defines FDMCS_OPENMP_SIMD;
+// the loops are compiled there through the explicit instantiations in
+// simulation.cc, and other targets skip the pragma instead of warning
+// about it.
+#ifdef FDMCS_OPENMP_SIMD
+#define FDMCS_PRAGMA(text) _Pragma(#text)
+#define FDMCS_OMP_SIMD(...) FDMCS_PRAGMA(omp simd __VA_ARGS__)
+#else
+#define FDMCS_OMP_SIMD(...)
+#endif
 
 typedef struct {
   long long count;
@@ -18,90 +45,631 @@ typedef struct {
   double remaining_rate;
 } SearchResult;
 
+// Moments of the size distribution, M_k = sum of size^k over all particles.
+struct Moments {
+  long long zeroth;
+  long long first;
+  // Exact while every partial sum stays below 2^53.
+  double second;
+};
+
 inline constexpr int kNumSmallParticles = 10000;
 
+// Particle groups stored as a structure of arrays. Counts and sizes are kept
+// as doubles, which is exact for all reachable values, so that the
+// rate-update loops run over contiguous arrays of a single type.
+struct ParticleGroups {
+  std::vector<double> counts;
+  std::vector<double> sizes;
+  std::vector<double> collision_rates;
+  // Kernel features of every size, one array per feature. Not part of saved
+  // states, they are recomputed on restore.
+  std::array<std::vector<double>, kMaxKernelFeatures> features;
+
+  inline int Size() const { return counts.size(); }
+
+  inline Particle Get(int i) const {
+    return Particle{(long long) counts[i], (long long) sizes[i], collision_rates[i]};
+  }
+
+  inline void Append(const Particle& particle, const KernelFeatures& size_features = {}) {
+    counts.push_back(particle.count);
+    sizes.push_back(particle.size);
+    collision_rates.push_back(particle.collision_rate);
+    for (int feature = 0; feature < kMaxKernelFeatures; feature++) {
+      features[feature].push_back(size_features[feature]);
+    }
+  }
+
+  inline void SetFeatures(int i, const KernelFeatures& size_features) {
+    for (int feature = 0; feature < kMaxKernelFeatures; feature++) {
+      features[feature][i] = size_features[feature];
+    }
+  }
+
+  // Moves the last group into slot `i` and drops the last slot.
+  inline void SwapRemove(int i) {
+    counts[i] = counts.back();
+    sizes[i] = sizes.back();
+    collision_rates[i] = collision_rates.back();
+    counts.pop_back();
+    sizes.pop_back();
+    collision_rates.pop_back();
+    for (auto& values : features) {
+      values[i] = values.back();
+      values.pop_back();
+    }
+  }
+};
+
+// Strategy used to choose the colliding pair in RunSimulationStep.
+enum class PairSelection {
+  // Every group keeps its exact collision rate and the pair is drawn directly
+  // from them.
+  kExact,
+  // The pair is drawn from a majorant kernel that is constant over every pair
+  // of size classes and accepted with probability K / K_majorant. Rejected
+  // draws are null events that still advance time. Collision rates of
+  // individual groups are not kept in this mode.
+  kMajorant,
+  // Only for kernels with a separable form. Keeps a weight tree per kernel
+  // factor, so adding or removing a particle costs O(r log N) for a kernel of
+  // rank r. Collision rates of groups are computed on demand.
+  kLowRank,
+};
+
+// Sampler used by the exact pair selection to draw the first particle.
+enum class FirstSampler {
+  // Binary sum tree over group rates, O(log N) per draw.
+  kSumTree,
+  // Composition-rejection over power-of-two rate classes, O(number of
+  // classes) per draw. Runs restored from a checkpoint draw different pairs
+  // than the run that saved it.
+  kRateClasses,
+};
+
+// Sampler used by the exact pair selection to draw the partner of the first
+// particle.
+enum class SecondSampler {
+  // Sums the exact collision rates of all groups, O(N) kernel evaluations.
+  kScan,
+  // Draws a size class from the majorant rates of the first particle's class,
+  // a uniform particle from it, and accepts it with probability
+  // K / K_majorant. Costs O(number of size classes) per draw plus O(1)
+  // expected rejections for kernels that vary slowly within a class.
+  kSizeClasses,
+};
+
+// Consistency checks run by RunSimulationStep. Independent of NDEBUG, a
+// failed check prints the inconsistency and aborts.
+enum class ValidationLevel {
+  kOff,
+  // Every `interval` steps, checks the particle count and the mass
+  // conservation of the step, and recounts the collision rate of one group,
+  // a different one at every check. O(N) per check.
+  kSampled,
+  // Every step, the same checks with the collision rates of all groups
+  // recounted. O(N^2) per step.
+  kFull,
+};
+
+// Complete state of a Simulation. Restoring it continues the run bit for
+// bit. See checkpoint.h for the file format.
+struct SimulationState {
+  PairSelection pair_selection;
+  float fragmentation_rate;
+  int step_counter;
+  // Total collision rate of the exact selection, 0 for the others. Only
+  // informative, restoring recomputes it from the collision rates.
+  double total_rate;
+  double cell_size;
+  long long num_particles;
+  long long num_initial_particles;
+  long long max_num_particles;
+  long long total_size;
+  int rate_tree_capacity;
+  // Small groups up to the last one that may be occupied, and all big groups.
+  ParticleGroups small_groups;
+  ParticleGroups big_groups;
+  // Size-class tracking only. Position of every big group inside of its size
+  // class, which fixes the order in which classes are sampled.
+  std::vector<int> big_class_positions;
+  int num_bounded_classes;
+  // Row-major num_bounded_classes x num_bounded_classes.
+  std::vector<double> class_bounds;
+  std::vector<double> class_rates;
+  // Low-rank selection only.
+  int factor_tree_capacity;
+  // Text form of the random engine, see RandomEngine::Serialize.
+  std::string rng;
+};
+
 class Simulation {
  public:
   Simulation();
-  Simulation(float fragmentation_rate, std::mt19937 rng);
+  Simulation(float fragmentation_rate, RandomEngine rng);
   void AddParticle(long long size);
   void AddMonomers(long long num_monomers);
+  // Adds `count` particles of `size` with a single pass over the current
+  // particles, instead of one pass per added particle.
+  void AddParticles(long long size, long long count);
+  // Adds `count` particles of `size` for every entry, one pass per entry.
+  // Collision rates of the entries are ignored.
+  void AddParticles(const std::vector<Particle>& particles);
   void DeleteParticle(int idx);
   void DeletePair(const std::pair<int, int>& idxs);
   void DuplicateParticles();
 
+  // Must be called before any particle is added.
+  void SetPairSelection(PairSelection pair_selection);
+  // Must be called before any particle is added.
+  void SetFirstSampler(FirstSampler first_sampler);
+  // Must be called before any particle is added.
+  void SetSecondSampler(SecondSampler second_sampler);
+  // Tabulates CollisionFunction for pairs of sizes below `cutoff`, which is
+  // capped at kNumSmallParticles. The table is built on first use. 0, the
+  // default, disables it.
+  void SetKernelTableCutoff(int cutoff);
+  // Memory taken by the kernel table once it is built.
+  inline size_t KernelTableBytes() const { return KernelTable::Bytes(kernel_table->Cutoff()); }
+  // Builds the kernel table now if it has a cutoff and is not built yet, and
+  // returns it for ShareKernelTable.
+  std::shared_ptr<KernelTable> BuiltKernelTable();
+  // Uses `table`, built by a simulation with the same kernel, instead of an
+  // own table. Built tables are only read, so simulations on different
+  // threads can share one. Must be called before any particle is added.
+  void ShareKernelTable(std::shared_ptr<KernelTable> table);
+  // Splits the rate-update loops, the partner search and the rate tree
+  // rebuild among `num_threads` threads whenever total_size is at least
+  // `threshold`. Results match the serial mode up to rounding of the rate
+  // sums, and runs with the same number of threads repeat exactly. 1, the
+  // default, disables the thread pool.
+  void SetParallelism(int num_threads, int threshold);
+
   std::pair<int, int> FindPair(double rate);
 
   double RunSimulationStep();
 
   std::vector<Particle> GetDistribution();
+  // Updated by every insertion and removal in O(1). Not part of saved
+  // states, restoring recounts them from the groups.
+  inline Moments GetMoments() const {
+    return Moments{num_particles, first_moment, second_moment};
+  }
+
+  // Not part of saved states.
+  void SetValidation(ValidationLevel level, int interval = 1);
+  // Compares the group counts with the particle count and recounts collision
+  // rates from the kernel, of all groups for kFull and of one group for
+  // kSampled. Also recounts the moments. Returns a description of the first inconsistency, or an empty
+  // string. Mass conservation is only checked by RunSimulationStep.
+  std::string CheckConsistency(ValidationLevel level);
+
+  // Copies the full state into `state`, reusing its storage.
+  void SaveState(SimulationState* state) const;
+  // Must be called on a simulation without particles, constructed with the
+  // same kernel as the one that saved the state. Collision rates are taken
+  // from the state as they are.
+  void RestoreState(const SimulationState& state);
 
+  // Empty unless built with FDMCS_ENABLE_PROFILING.
+  inline const Profile& GetProfile() const { return profile; }
+
+  // Kernel interface used outside of the hot loops. Implemented by
+  // KernelSimulation, see the Kernel policies in kernels.h.
   virtual double CollisionFunction(long long first_size, long long second_size) = 0;
+  virtual KernelFeatures SizeFeatures(double size) = 0;
+  virtual double CollisionBound(long long min_first, long long max_first,
+                                long long min_second, long long max_second) = 0;
+  virtual std::vector<SeparableTerm> SeparableTerms() = 0;
+  virtual void SeparableFactors(long long size, double* factors) = 0;
+
+ protected:
+  Particle GetParticle(int idx);
+
+  // One past the largest occupied small group.
+  inline int SmallExtent() const { return occupied_sizes.Extent(); }
+
+  inline bool RunsParallel() const {
+    return thread_pool != nullptr && total_size >= parallel_threshold;
+  }
+  // Start of part `part` out of `num_parts` of about equal length in [0, n).
+  static inline int SplitPoint(int n, int part, int num_parts) {
+    return (long long) n * part / num_parts;
+  }
+
+  // Groups with sizes below kNumSmallParticles, indexed by size.
+  ParticleGroups small_groups;
+  // Small sizes with a non-zero count.
+  OccupiedSizes occupied_sizes;
+  // One group per distinct big size, addressed by `idx - kNumSmallParticles`.
+  ParticleGroups big_groups;
+  // Group rates (collision_rate * count) indexed the same way as particles.
+  RateTree rate_tree;
+  long long total_size;
+  // Possibly shared with other simulations, see ShareKernelTable.
+  std::shared_ptr<KernelTable> kernel_table;
+  std::unique_ptr<ThreadPool> thread_pool;
+  int parallel_threshold;
+  // One value per thread or per part of the parallel loops.
+  std::vector<double> partial_rates;
 
  private:
-  Particle& GetParticle(int idx);
+  // Adds `multiplier` collisions with a particle of `size` to the collision
+  // rate of every group. Returns the collision rate of a single particle of
+  // `size` with all current particles.
+  virtual double UpdateCollisionRates(long long size, double multiplier) = 0;
+  virtual SearchResult FindSecond(SearchResult first) = 0;
+  // Fills the kernel table using all hardware threads.
+  virtual void BuildKernelTable() = 0;
 
   void InsertParticle(long long size, double rate);
+  // Inserts `count` particles of `size`, each with collision rate `rate`.
+  void InsertParticles(long long size, long long count, double rate);
   void RemoveParticle(int idx);
-  inline void IncrementParticleCount(int increment);
+  // Swap-removes an empty big group and keeps big_slots in sync.
+  void RemoveBigGroup(int slot);
+  inline void IncrementParticleCount(long long increment);
+  // One past the last occupied index: past the big groups if there are any,
+  // past the largest occupied small size otherwise.
+  void UpdateTotalSize();
 
   SearchResult FindFirst(double rate);
-  SearchResult FindSecond(SearchResult first);
+  SearchResult FindSecondBySizeClass(int first);
 
-  double CountTotalRate();
+  // Total rate of the exact selection. Read from the rate tree, which sums
+  // the current group rates on every rebuild, so it carries no rounding
+  // errors over from earlier events.
+  double CountTotalRate() const;
+  // Brings the rate tree, and the rate classes if used, in sync with the
+  // leaves written by the rate-update loops.
+  void RebuildRates();
+
+  // Rate used to draw the next event and its time increment.
+  double EventRate();
+
+  // Sum of count * size over all groups.
+  long long CountMass();
+  // Sets the first and second moment from the groups.
+  void RecountMoments();
+  // Runs the checks of validation_level and aborts on a failure.
+  void Validate(long long expected_mass);
+
+  // Whether size_classes and the majorant class rates are maintained.
+  inline bool TracksSizeClasses() const {
+    return pair_selection == PairSelection::kMajorant ||
+           second_sampler == SecondSampler::kSizeClasses;
+  }
+  bool FindMajorantPair(double rate, std::pair<int, int>* pair);
+  double CountMajorantRate();
+  void UpdateClassCount(int size_class, long long delta);
+  void CountClassRates();
+
+  bool FindLowRankPair(std::pair<int, int>* pair);
+  double CountLowRankRate();
+  double LowRankCollisionRate(long long size);
+  void UpdateFactorLeaves(int idx);
 
-  std::array<Particle, kNumSmallParticles> small_particles;
-  std::vector<Particle> big_particles;
-  double total_rate;
-  long long total_size;
   long long num_particles;
   long long num_initial_particles;
   long long max_num_particles;
-  std::mt19937 rng;
+  long long first_moment;
+  double second_moment;
+  RandomEngine rng;
   double cell_size;
 
   float fragmentation_rate;
 
   int step_counter;
+
+  ValidationLevel validation_level;
+  int validation_interval;
+
+  PairSelection pair_selection;
+  FirstSampler first_sampler;
+  // Mirrors the rate tree leaves when first_sampler is kRateClasses.
+  RateClasses rate_classes;
+  SecondSampler second_sampler;
+  // Slot of the big group of every big size.
+  std::unordered_map<long long, int> big_slots;
+  SizeClassIndex size_classes;
+  // Majorant kernel value for every pair of size classes.
+  std::array<std::array<double, kNumSizeClasses>, kNumSizeClasses> class_bounds;
+  int num_bounded_classes;
+  // Majorant collision rate of a single particle from each size class.
+  std::array<double, kNumSizeClasses> class_rates;
+
+  std::vector<SeparableTerm> separable_terms;
+  // count * f(size) for every kernel factor f, indexed the same way as
+  // particles. Roots hold the factor sums over all particles.
+  std::vector<RateTree> factor_trees;
+  // count * K(size, size), used to exclude collisions of a particle with
+  // itself.
+  RateTree self_rate_tree;
+  std::vector<double> factors;
+
+  Profile profile;
 };
 
-class ConstantKernelSimulation : public Simulation {
-  using Simulation::Simulation;
-  inline double CollisionFunction(long long first_size, long long second_size) override {
-    return 1.0;
+// Simulation specialized for a kernel policy from kernels.h. Kernel
+// evaluations inside of the rate-update and search loops are resolved at
+// compile time, so they can be inlined.
+template <typename Kernel>
+class KernelSimulation : public Simulation {
+ public:
+  KernelSimulation() = default;
+  KernelSimulation(float fragmentation_rate, RandomEngine rng, Kernel kernel = Kernel())
+      : Simulation(fragmentation_rate, rng), kernel_(kernel) {}
+
+  // Evaluated from features, so that it matches the values summed by the
+  // rate-update loops. Pairs of sizes below the kernel table cutoff are
+  // looked up.
+  double CollisionFunction(long long first_size, long long second_size) final {
+    const KernelTable& table = *kernel_table;
+    if (first_size < table.Cutoff() && second_size < table.Cutoff()) {
+      if (!table.Built()) {
+        BuildKernelTable();
+      }
+      return table.Get(first_size, second_size);
+    }
+    return kernel_.FromFeatures(kernel_.Features(first_size), kernel_.Features(second_size));
   }
-};
 
-class MultiplicationKernelSimulation : public Simulation {
-  using Simulation::Simulation;
-  inline double CollisionFunction(long long first_size, long long second_size) override {
-    return first_size * second_size / 100000.0;
+  KernelFeatures SizeFeatures(double size) final {
+    return kernel_.Features(size);
   }
-};
 
-class BallisticKernelSimulation : public Simulation {
-  using Simulation::Simulation;
-  inline double CollisionFunction(long long first_size, long long second_size) override {
-    double first = first_size;
-    double second = second_size;
-    double first_term = pow(pow(first, 1.0/3.0) + pow(second, 1.0/3.0), 2.0);
-    double second_term = pow(1.0 / first + 1.0 / second, 0.5);
-    return first_term * second_term;
+  double CollisionBound(long long min_first, long long max_first,
+                        long long min_second, long long max_second) final {
+    return kernel_.Bound(min_first, max_first, min_second, max_second);
   }
-};
 
-class BrownianKernelSimulation : public Simulation {
- public:
-  BrownianKernelSimulation(double alpha); 
-  BrownianKernelSimulation(float fragmentation_rate, std::mt19937 rng, double alpha);
-  inline double CollisionFunction(long long first_size, long long second_size) override {
-    double fraction = first_size / (double) second_size;
-    double inverse = second_size / (double) first_size;
-    double first_term = pow(fraction, alpha_);
-    double second_term = pow(inverse, alpha_);
-    return first_term + second_term;
+  std::vector<SeparableTerm> SeparableTerms() final {
+    return kernel_.SeparableTerms();
   }
+
+  void SeparableFactors(long long size, double* factors) final {
+    kernel_.SeparableFactors(size, factors);
+  }
+
  private:
-  double alpha_;
+  // Number of groups whose rates FindSecond sums at once before it falls back
+  // to a group-by-group scan.
+  static constexpr int kScanBlockSize = 16;
+
+  double UpdateCollisionRates(long long size, double multiplier) final;
+  SearchResult FindSecond(SearchResult first) final;
+  void BuildKernelTable() final;
+
+  // UpdateCollisionRates over groups [first, last) of a single tier, for a
+  // size with features `size_features`.
+  double UpdateGroupRates(const KernelFeatures& size_features, double multiplier, int first,
+                          int last, ParticleGroups* groups, double* leaves);
+
+  // Sum of the collision rates of groups [first, last) of a single tier with
+  // a particle of `first_features`, excluding the particle itself.
+  double SumGroupRates(const KernelFeatures& first_features, int first, int last, int excluded,
+                       const ParticleGroups& groups);
+
+  // Finds the group among [first, last) of a single tier that holds `rate`.
+  // Returns -1 and reduces `rate` by the tier total if there is none.
+  int ScanGroups(const KernelFeatures& first_features, int first, int last, int excluded,
+                 const ParticleGroups& groups, double* rate);
+
+  Kernel kernel_;
 };
+
+using ConstantKernelSimulation = KernelSimulation<ConstantKernel>;
+using MultiplicationKernelSimulation = KernelSimulation<MultiplicationKernel>;
+using BallisticKernelSimulation = KernelSimulation<BallisticKernel>;
+using BrownianKernelSimulation = KernelSimulation<BrownianKernel>;
+
+
+template <typename Kernel>
+double KernelSimulation<Kernel>::UpdateCollisionRates(long long size, double multiplier) {
+  double* leaves = rate_tree.MutableLeaves();
+  KernelFeatures size_features = kernel_.Features(size);
+  // Updates part `part` of the small blocks and of the big groups.
+  auto update_part = [&](int part, int num_parts) {
+    int num_blocks = occupied_sizes.NumBlocks();
+    int num_big = big_groups.Size();
+    double rate = 0;
+    occupied_sizes.ForEachRangeInBlocks(SplitPoint(num_blocks, part, num_parts),
+                                        SplitPoint(num_blocks, part + 1, num_parts),
+                                        [&](int begin, int end) {
+      rate += UpdateGroupRates(size_features, multiplier, begin, end, &small_groups, leaves);
+    });
+    rate += UpdateGroupRates(size_features, multiplier, SplitPoint(num_big, part, num_parts),
+                             SplitPoint(num_big, part + 1, num_parts), &big_groups,
+                             leaves + kNumSmallParticles);
+    return rate;
+  };
+  if (!RunsParallel()) {
+    return update_part(0, 1);
+  }
+
+  int num_threads = thread_pool->NumThreads();
+  thread_pool->Run([&](int thread) {
+    partial_rates[thread] = update_part(thread, num_threads);
+  });
+  double rate = 0;
+  for (int thread = 0; thread < num_threads; thread++) {
+    rate += partial_rates[thread];
+  }
+  return rate;
+}
+
+
+template <typename Kernel>
+double KernelSimulation<Kernel>::UpdateGroupRates(const KernelFeatures& size_features,
+                                                  double multiplier, int first, int last,
+                                                  ParticleGroups* groups, double* leaves) {
+  static_assert(kMaxKernelFeatures == 2);
+  const double* counts = groups->counts.data();
+  const double* features_a = groups->features[0].data();
+  const double* features_b = groups->features[1].data();
+  double size_a = size_features[0];
+  double size_b = size_features[1];
+  double* collision_rates = groups->collision_rates.data();
+  double rate = 0;
+FDMCS_OMP_SIMD(reduction(+:rate))
+  for (int i = first; i < last; i++) {
+    double collision_value = kernel_.FromFeatures(size_a, size_b, features_a[i], features_b[i]);
+    rate += collision_value * counts[i];
+    collision_rates[i] += collision_value * multiplier;
+    leaves[i] = collision_rates[i] * counts[i];
+  }
+  return rate;
+}
+
+
+template <typename Kernel>
+SearchResult KernelSimulation<Kernel>::FindSecond(SearchResult first) {
+  double rate = first.remaining_rate;
+  KernelFeatures first_features = kernel_.Features(GetParticle(first.idx).size);
+  int num_blocks = occupied_sizes.NumBlocks();
+  int num_big = big_groups.Size();
+  int excluded_slot = first.idx - kNumSmallParticles;
+
+  // Partners are ordered by part, and within a part small groups come before
+  // big groups. The serial mode has a single part.
+  auto scan_part = [&](int part, int num_parts) {
+    int idx = -1;
+    occupied_sizes.FindInRangesInBlocks(SplitPoint(num_blocks, part, num_parts),
+                                        SplitPoint(num_blocks, part + 1, num_parts),
+                                        [&](int begin, int end) {
+      idx = ScanGroups(first_features, begin, end, first.idx, small_groups, &rate);
+      return idx >= 0;
+    });
+    if (idx >= 0) {
+      return idx;
+    }
+    idx = ScanGroups(first_features, SplitPoint(num_big, part, num_parts),
+                     SplitPoint(num_big, part + 1, num_parts), excluded_slot, big_groups, &rate);
+    return idx >= 0 ? kNumSmallParticles + idx : -1;
+  };
+
+  int idx = -1;
+  if (!RunsParallel()) {
+    idx = scan_part(0, 1);
+  } else {
+    // Sums every part in parallel, then scans only the part holding `rate`.
+    int num_threads = thread_pool->NumThreads();
+    thread_pool->Run([&](int thread) {
+      double part_rate = 0;
+      occupied_sizes.ForEachRangeInBlocks(SplitPoint(num_blocks, thread, num_threads),
+                                          SplitPoint(num_blocks, thread + 1, num_threads),
+                                          [&](int begin, int end) {
+        part_rate += SumGroupRates(first_features, begin, end, first.idx, small_groups);
+      });
+      part_rate += SumGroupRates(first_features, SplitPoint(num_big, thread, num_threads),
+                                 SplitPoint(num_big, thread + 1, num_threads), excluded_slot,
+                                 big_groups);
+      partial_rates[thread] = part_rate;
+    });
+    for (int part = 0; part < num_threads && idx < 0; part++) {
+      if (part + 1 < num_threads && rate - partial_rates[part] > 0) {
+        rate -= partial_rates[part];
+        continue;
+      }
+      idx = scan_part(part, num_threads);
+    }
+  }
+  if (idx >= 0) {
+    return SearchResult{idx, rate};
+  }
+
+  // Rounding pushed the rate past the last group, fall back to the last
+  // possible partner.
+  for (idx = total_size - 1; idx > 0; idx--) {
+    if (GetParticle(idx).count > (idx == first.idx)) {
+      break;
+    }
+  }
+  return SearchResult{idx, 0};
+}
+
+
+template <typename Kernel>
+double KernelSimulation<Kernel>::SumGroupRates(const KernelFeatures& first_features, int first,
+                                               int last, int excluded,
+                                               const ParticleGroups& groups) {
+  const double* counts = groups.counts.data();
+  const double* features_a = groups.features[0].data();
+  const double* features_b = groups.features[1].data();
+  double first_a = first_features[0];
+  double first_b = first_features[1];
+  double rate = 0;
+FDMCS_OMP_SIMD(reduction(+:rate))
+  for (int i = first; i < last; i++) {
+    rate += kernel_.FromFeatures(first_a, first_b, features_a[i], features_b[i]) * counts[i];
+  }
+  if (excluded >= first && excluded < last) {
+    rate -= kernel_.FromFeatures(first_a, first_b, features_a[excluded], features_b[excluded]);
+  }
+  return rate;
+}
+
+
+template <typename Kernel>
+int KernelSimulation<Kernel>::ScanGroups(const KernelFeatures& first_features, int first,
+                                         int last, int excluded, const ParticleGroups& groups,
+                                         double* rate) {
+  const double* counts = groups.counts.data();
+  const double* features_a = groups.features[0].data();
+  const double* features_b = groups.features[1].data();
+  double first_a = first_features[0];
+  double first_b = first_features[1];
+  auto group_kernel = [&](int i) {
+    return kernel_.FromFeatures(first_a, first_b, features_a[i], features_b[i]);
+  };
+  int begin = first;
+  while (begin < last) {
+    int end = std::min(begin + kScanBlockSize, last);
+    double block_rate = SumGroupRates(first_features, begin, end, excluded, groups);
+    if (*rate - block_rate > 0) {
+      *rate -= block_rate;
+      begin = end;
+      continue;
+    }
+
+    for (int i = begin; i < end; i++) {
+      double count = counts[i] - (i == excluded);
+      double group_rate = group_kernel(i) * count;
+      if (count > 0 && *rate - group_rate <= 0) {
+        return i;
+      }
+      *rate -= group_rate;
+    }
+    begin = end;
+  }
+  return -1;
+}
+
+template <typename Kernel>
+void KernelSimulation<Kernel>::BuildKernelTable() {
+  static_assert(kMaxKernelFeatures == 2);
+  int cutoff = kernel_table->Cutoff();
+  std::vector<double> features_a(cutoff);
+  std::vector<double> features_b(cutoff);
+  for (int size = 0; size < cutoff; size++) {
+    KernelFeatures size_features = kernel_.Features(size);
+    features_a[size] = size_features[0];
+    features_b[size] = size_features[1];
+  }
+  int num_threads = std::max<int>(1, std::thread::hardware_concurrency());
+  kernel_table->Build([&](int row, double* values) {
+    double row_a = features_a[row];
+    double row_b = features_b[row];
+FDMCS_OMP_SIMD()
+    for (int column = 0; column <= row; column++) {
+      values[column] = kernel_.FromFeatures(row_a, row_b, features_a[column], features_b[column]);
+    }
+  }, num_threads);
+}
+
+extern template class KernelSimulation<ConstantKernel>;
+extern template class KernelSimulation<MultiplicationKernel>;
+extern template class KernelSimulation<BallisticKernel>;
+extern template class KernelSimulation<BrownianKernel>;
 #endif
@@ -1,53 +1,265 @@
 #include "simulation.h"
 
-#include <chrono>
-#include <iostream>
-#include <iomanip>
 #include <random>
 
-using std::chrono::high_resolution_clock;
-using std::chrono::nanoseconds;
-using std::chrono::microseconds;
-using std::chrono::duration_cast;
+#include "benchmark/benchmark.h"
+
+// Run with --benchmark_out=<file> --benchmark_out_format=json to keep the
+// results for comparisons across changes.
 
 namespace {
 
-void PrintParticles(const std::vector<Particle>& particles) {
-  for (const auto& particle : particles) {
-    std::cout << "Particle size: " << particle.size
-              << ", count: " << particle.count
-              << ", collision rate: " << particle.collision_rate << std::endl;
+template <typename Kernel>
+Kernel MakeKernel() {
+  return Kernel();
+}
+
+template <>
+BrownianKernel MakeKernel<BrownianKernel>() {
+  return BrownianKernel(/*alpha=*/0.9);
+}
+
+template <typename Kernel>
+KernelSimulation<Kernel> MakeSimulation() {
+  return KernelSimulation<Kernel>(/*fragmentation_rate=*/0.2, std::mt19937(), MakeKernel<Kernel>());
+}
+
+// Fills the sizes [1, num_sizes] with `count` particles each.
+void AddSpread(Simulation* simulation, int num_sizes, long long count) {
+  std::vector<Particle> particles;
+  for (int size = 1; size <= num_sizes; size++) {
+    particles.push_back(Particle{count, size, 0});
   }
+  simulation->AddParticles(particles);
 }
 
-nanoseconds recordDuration(Simulation& simulation, int num_iterations) {
-  auto start = high_resolution_clock::now();
+// Collision rate of all pairs, which FindPair draws from.
+double TotalRate(Simulation& simulation) {
+  double rate = 0;
+  for (const auto& particle : simulation.GetDistribution()) {
+    rate += particle.collision_rate * particle.count;
+  }
+  return rate;
+}
+
+void ReportEvents(benchmark::State& state) {
+  state.counters["events_per_second"] =
+      benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+}
 
-  for (int i = 0; i < num_iterations; i++) {
-    simulation.RunSimulationStep();
+// Full events starting from `state.range(0)` monomers.
+template <typename Kernel>
+void BM_RunSimulationStep(benchmark::State& state) {
+  auto simulation = MakeSimulation<Kernel>();
+  simulation.AddMonomers(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(simulation.RunSimulationStep());
   }
+  ReportEvents(state);
+}
 
-  auto end = high_resolution_clock::now();
-  return end - start;
+// Full events with every small size populated by `state.range(0)` particles,
+// so each event sweeps all small groups.
+template <typename Kernel>
+void BM_RunSimulationStepAllSizes(benchmark::State& state) {
+  auto simulation = MakeSimulation<Kernel>();
+  AddSpread(&simulation, kNumSmallParticles - 1, state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(simulation.RunSimulationStep());
+  }
+  ReportEvents(state);
+}
+
+// Full events from `state.range(0)` monomers, drawing from the RngEngine
+// `state.range(1)`.
+template <typename Kernel>
+void BM_RunSimulationStepEngine(benchmark::State& state) {
+  KernelSimulation<Kernel> simulation(
+      /*fragmentation_rate=*/0.2, RandomEngine(static_cast<RngEngine>(state.range(1)), /*seed=*/1),
+      MakeKernel<Kernel>());
+  simulation.AddMonomers(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(simulation.RunSimulationStep());
+  }
+  ReportEvents(state);
+}
+
+// Uniform doubles of the RngEngine `state.range(0)`.
+void BM_UniformDraw(benchmark::State& state) {
+  RandomEngine engine(static_cast<RngEngine>(state.range(0)), /*seed=*/1);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(engine.Uniform());
+  }
+  ReportEvents(state);
+}
+
+// The remaining benchmarks run on `state.range(0)` populated sizes.
+
+// `state.range(1)` selects the FirstSampler, `state.range(2)` the
+// SecondSampler.
+template <typename Kernel>
+void BM_FindPair(benchmark::State& state) {
+  auto simulation = MakeSimulation<Kernel>();
+  simulation.SetFirstSampler(static_cast<FirstSampler>(state.range(1)));
+  simulation.SetSecondSampler(static_cast<SecondSampler>(state.range(2)));
+  AddSpread(&simulation, state.range(0), 1000);
+  std::mt19937 rng;
+  std::uniform_real_distribution<double> rate_dist(0, TotalRate(simulation));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(simulation.FindPair(rate_dist(rng)));
+  }
+  ReportEvents(state);
+}
+
+template <typename Kernel>
+void BM_AddParticle(benchmark::State& state) {
+  auto simulation = MakeSimulation<Kernel>();
+  int num_sizes = state.range(0);
+  AddSpread(&simulation, num_sizes, 1000);
+  int size = 1;
+  for (auto _ : state) {
+    simulation.AddParticle(size);
+    size = size % num_sizes + 1;
+  }
+  ReportEvents(state);
 }
-} // namespace
 
-int main(int argc, char const *argv[]) {
+// Speedup curve of the parallel loops: `state.range(1)` threads on
+// `state.range(0)` populated sizes. Compare real times against one thread.
+template <typename Kernel>
+void BM_AddParticleParallel(benchmark::State& state) {
+  auto simulation = MakeSimulation<Kernel>();
+  simulation.SetParallelism(state.range(1), /*threshold=*/0);
+  int num_sizes = state.range(0);
+  AddSpread(&simulation, num_sizes, 1000);
+  int size = 1;
+  for (auto _ : state) {
+    simulation.AddParticle(size);
+    size = size % num_sizes + 1;
+  }
+  ReportEvents(state);
+}
 
-  std::vector<int> initial_monomers{1000, 10000, 100'000, 1'000'000};
+template <typename Kernel>
+void BM_FindPairParallel(benchmark::State& state) {
+  auto simulation = MakeSimulation<Kernel>();
+  simulation.SetParallelism(state.range(1), /*threshold=*/0);
+  AddSpread(&simulation, state.range(0), 1000);
+  std::mt19937 rng;
+  std::uniform_real_distribution<double> rate_dist(0, TotalRate(simulation));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(simulation.FindPair(rate_dist(rng)));
+  }
+  ReportEvents(state);
+}
 
-  const int num_iterations = 1 * 1000 * 1;
+template <typename Kernel>
+void BM_AddMonomers(benchmark::State& state) {
+  auto simulation = MakeSimulation<Kernel>();
+  AddSpread(&simulation, state.range(0), 1000);
+  for (auto _ : state) {
+    simulation.AddMonomers(10);
+  }
+  ReportEvents(state);
+}
+
+// Monomer-dominated run: `state.range(0)` populated sizes next to a single
+// particle just below kNumSmallParticles, so most small slots are empty.
+template <typename Kernel>
+void BM_AddParticleSparse(benchmark::State& state) {
+  auto simulation = MakeSimulation<Kernel>();
+  int num_sizes = state.range(0);
+  AddSpread(&simulation, num_sizes, 1000);
+  simulation.AddParticle(kNumSmallParticles - 1);
+  int size = 1;
+  for (auto _ : state) {
+    simulation.AddParticle(size);
+    size = size % num_sizes + 1;
+  }
+  ReportEvents(state);
+}
 
-  std::cout << std::setprecision(10);
+// `state.range(0)` big particles of a single size, as left behind by
+// repeated duplication.
+template <typename Kernel>
+void BM_AddParticleEqualBig(benchmark::State& state) {
+  auto simulation = MakeSimulation<Kernel>();
+  AddSpread(&simulation, 10, 1000);
+  simulation.AddParticles(kNumSmallParticles + 1, state.range(0));
+  int size = 1;
+  for (auto _ : state) {
+    simulation.AddParticle(size);
+    size = size % 10 + 1;
+  }
+  ReportEvents(state);
+}
 
-  std::cout << "Completing " << num_iterations << " for each experiment." << std::endl;
-  for (auto num_monomers : initial_monomers) {
-    const float fragmentation_rate = 0.2;
-    BrownianKernelSimulation simulation(fragmentation_rate, std::mt19937(), 0.9);
-    simulation.AddMonomers(num_monomers);
-    nanoseconds running_time = recordDuration(simulation, num_iterations);
-    std::cout << "  Running time for " << num_monomers << " monomers is " <<
-        duration_cast<microseconds>(running_time).count()  << " microseconds."<< std::endl;
+// Kernel evaluations for random pairs of sizes below 1000, with a kernel
+// table cutoff of `state.range(0)`.
+template <typename Kernel>
+void BM_CollisionFunction(benchmark::State& state) {
+  auto simulation = MakeSimulation<Kernel>();
+  simulation.SetKernelTableCutoff(state.range(0));
+  std::mt19937 rng;
+  std::uniform_int_distribution<long long> size_dist(1, 999);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(simulation.CollisionFunction(size_dist(rng), size_dist(rng)));
   }
-  return 0;
+  ReportEvents(state);
 }
+
+template <typename Kernel>
+void BM_DeleteParticle(benchmark::State& state) {
+  auto simulation = MakeSimulation<Kernel>();
+  int num_sizes = state.range(0);
+  // Enough particles that no size runs out within the benchmark.
+  AddSpread(&simulation, num_sizes, 10'000'000);
+  int idx = 1;
+  for (auto _ : state) {
+    simulation.DeleteParticle(idx);
+    idx = idx % num_sizes + 1;
+  }
+  ReportEvents(state);
+}
+
+template <typename Kernel>
+void BM_DuplicateParticles(benchmark::State& state) {
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto simulation = MakeSimulation<Kernel>();
+    AddSpread(&simulation, state.range(0), 1000);
+    state.ResumeTiming();
+    simulation.DuplicateParticles();
+  }
+  ReportEvents(state);
+}
+
+#define FDMCS_KERNEL_BENCHMARKS(Kernel)                                                   \
+  BENCHMARK_TEMPLATE(BM_RunSimulationStep, Kernel)->RangeMultiplier(10)->Range(1000, 10'000'000); \
+  BENCHMARK_TEMPLATE(BM_RunSimulationStepAllSizes, Kernel)->Arg(1)->Arg(10);             \
+  BENCHMARK_TEMPLATE(BM_FindPair, Kernel)->ArgsProduct({{100, 1000, 9999}, {0, 1}, {0, 1}}); \
+  BENCHMARK_TEMPLATE(BM_AddParticle, Kernel)->Arg(100)->Arg(1000)->Arg(9999);            \
+  BENCHMARK_TEMPLATE(BM_AddParticleSparse, Kernel)->Arg(10)->Arg(100);                   \
+  BENCHMARK_TEMPLATE(BM_AddParticleEqualBig, Kernel)->Arg(100)->Arg(10000);              \
+  BENCHMARK_TEMPLATE(BM_AddParticleParallel, Kernel)                                     \
+      ->ArgsProduct({{1000, 9999}, {1, 2, 4, 8, 16, 32, 64}})->UseRealTime();            \
+  BENCHMARK_TEMPLATE(BM_FindPairParallel, Kernel)                                        \
+      ->ArgsProduct({{1000, 9999}, {1, 2, 4, 8, 16, 32, 64}})->UseRealTime();            \
+  BENCHMARK_TEMPLATE(BM_AddMonomers, Kernel)->Arg(100)->Arg(1000)->Arg(9999);            \
+  BENCHMARK_TEMPLATE(BM_CollisionFunction, Kernel)->Arg(0)->Arg(1000);                  \
+  BENCHMARK_TEMPLATE(BM_DeleteParticle, Kernel)->Arg(100)->Arg(1000)->Arg(9999);         \
+  BENCHMARK_TEMPLATE(BM_DuplicateParticles, Kernel)->Arg(100)->Arg(1000)->Arg(9999)
+
+FDMCS_KERNEL_BENCHMARKS(ConstantKernel);
+FDMCS_KERNEL_BENCHMARKS(BallisticKernel);
+FDMCS_KERNEL_BENCHMARKS(BrownianKernel);
+FDMCS_KERNEL_BENCHMARKS(MultiplicationKernel);
+
+// The constant kernel has the cheapest events, so the engine matters most.
+BENCHMARK_TEMPLATE(BM_RunSimulationStepEngine, ConstantKernel)
+    ->ArgsProduct({{1000, 1'000'000}, {0, 1, 2, 3}});
+BENCHMARK(BM_UniformDraw)->DenseRange(0, 3);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,85 @@
+#ifndef FDMCS_SIMULATION_CONFIG
+#define FDMCS_SIMULATION_CONFIG
+
+#include "FDMCS/simulation.pb.h"
+#include "FDMCS/simulation.h"
+
+#include <iostream>
+#include <memory>
+#include <random>
+
+// Stream `stream` of the engine and seed of `config`.
+RandomEngine ConstructRandomEngine(const SimulationConfiguration& config, uint64_t seed,
+                                   uint64_t stream = 0) {
+  return RandomEngine(static_cast<RngEngine>(config.rng_engine()),
+                      seed != 0 ? seed : std::mt19937::default_seed, stream);
+}
+
+// Constructs a simulation without particles for the kernel and pair
+// selection of `config`.
+std::unique_ptr<Simulation> ConstructEmptySimulation(const SimulationConfiguration& config,
+                                                     RandomEngine rng = RandomEngine()) {
+  std::unique_ptr<Simulation> sim;
+  switch (config.kernel_type()) {
+    case SimulationConfiguration::UNKNOWN :
+      std::cerr << "Kernel unknown" << std::endl;
+      exit(1);
+      break;
+    case SimulationConfiguration::CONSTANT :
+      sim = std::make_unique<ConstantKernelSimulation>(config.fragmentation_rate(), rng);
+      break;
+    case SimulationConfiguration::BALLISTIC :
+      sim = std::make_unique<BallisticKernelSimulation>(config.fragmentation_rate(), rng);
+      break;
+    case SimulationConfiguration::MULTIPLICATION :
+      sim = std::make_unique<MultiplicationKernelSimulation>(config.fragmentation_rate(), rng);
+      break;
+    case SimulationConfiguration::BROWNIAN :
+      sim = std::make_unique<BrownianKernelSimulation>(config.fragmentation_rate(), rng,
+          config.brownian_kernel_params().alpha());
+      break;
+  }
+
+  switch (config.pair_selection()) {
+    case SimulationConfiguration::MAJORANT :
+      sim->SetPairSelection(PairSelection::kMajorant);
+      break;
+    case SimulationConfiguration::LOW_RANK :
+      if (sim->SeparableTerms().empty()) {
+        std::cerr << "Low-rank pair selection requires a separable kernel." << std::endl;
+        exit(1);
+      }
+      sim->SetPairSelection(PairSelection::kLowRank);
+      break;
+    default :
+      break;
+  }
+
+  if (config.first_sampler() == SimulationConfiguration::RATE_CLASSES) {
+    sim->SetFirstSampler(FirstSampler::kRateClasses);
+  }
+  if (config.second_sampler() == SimulationConfiguration::SIZE_CLASSES) {
+    sim->SetSecondSampler(SecondSampler::kSizeClasses);
+  }
+  sim->SetKernelTableCutoff(config.kernel_table_cutoff());
+
+  if (config.num_threads() > 1) {
+    sim->SetParallelism(config.num_threads(),
+                        config.parallel_threshold() > 0 ? config.parallel_threshold() : 4096);
+  }
+
+  switch (config.validation_level()) {
+    case SimulationConfiguration::SAMPLED :
+      sim->SetValidation(ValidationLevel::kSampled,
+                         config.validation_interval() > 0 ? config.validation_interval() : 1000);
+      break;
+    case SimulationConfiguration::FULL :
+      sim->SetValidation(ValidationLevel::kFull);
+      break;
+    default :
+      break;
+  }
+  return sim;
+}
+
+#endif
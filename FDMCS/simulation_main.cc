@@ -1,61 +1,98 @@
 #include "FDMCS/simulation.pb.h"
 #include "FDMCS/simulation.h"
+#include "FDMCS/checkpoint_writer.h"
+#include "FDMCS/ensemble.h"
 #include "FDMCS/io_util.h"
+#include "FDMCS/moment_series.h"
+#include "FDMCS/simulation_config.h"
+#include "FDMCS/thread_pool.h"
 
 #include <google/protobuf/util/json_util.h>
+#include <atomic>
 #include <iostream>
 
 using std::chrono::high_resolution_clock;
 using std::chrono::nanoseconds;
 using ::google::protobuf::util::JsonStringToMessage;
 
+// Checkpoints waiting for the writer thread before the simulation blocks.
+constexpr int kMaxPendingCheckpoints = 4;
 
-nanoseconds RunSimulation(Simulation& simulation, float duration, const SaveOptions& save_options) {
-  double simulation_time = 0;
-  int last_checkpoint_num = -1;
+// Runs until `duration` starting from `simulation_time`, which is non-zero
+// for runs resumed from a checkpoint.
+nanoseconds RunSimulation(Simulation& simulation, float duration, const SaveOptions& save_options,
+                          double simulation_time, nanoseconds previous_elapsed_time) {
+  int last_checkpoint_num = simulation_time > 0 ?
+      int(simulation_time / save_options.checkpoint_interval()) : -1;
   int checkpoint_num = 0;
+  float moments_interval = save_options.moments_interval();
+  int last_moments_num = simulation_time > 0 && moments_interval > 0 ?
+      int(simulation_time / moments_interval) : -1;
+
+  std::filesystem::create_directories(save_options.output_dir());
+  CheckpointWriter writer(kMaxPendingCheckpoints);
+  // One line per checkpoint, only written by profiling builds.
+  std::ofstream profile_out;
+  if (kProfilingEnabled) {
+    profile_out.open(save_options.output_dir() + "/profile.jsonl", std::ios::out | std::ios::app);
+  }
+  std::unique_ptr<MomentSeriesWriter> moments_writer;
+  if (moments_interval > 0) {
+    std::string path = save_options.output_dir() + "/moments.bin";
+    moments_writer = std::make_unique<MomentSeriesWriter>(path);
+    if (!moments_writer->Good()) {
+      std::cerr << "Cannot write moments " << path << std::endl;
+      exit(1);
+    }
+  }
 
   auto start_time = high_resolution_clock::now();
   while (simulation_time < duration) {
     simulation_time += simulation.RunSimulationStep();
 
+    if (moments_writer != nullptr && int(simulation_time / moments_interval) > last_moments_num) {
+      last_moments_num = int(simulation_time / moments_interval);
+      moments_writer->Append(simulation_time, simulation.GetMoments());
+    }
+
     checkpoint_num = int(simulation_time / save_options.checkpoint_interval());
     if (checkpoint_num > last_checkpoint_num) {
       last_checkpoint_num = checkpoint_num;
-      auto elapsed_time = high_resolution_clock::now() - start_time;
-      SaveCheckpoint(simulation, save_options.output_dir(), simulation_time, checkpoint_num,
-        elapsed_time);
+      auto elapsed_time = previous_elapsed_time + (high_resolution_clock::now() - start_time);
+      std::string path = CheckpointPath(save_options.output_dir(), simulation_time);
+      std::cout << path << "\n";
+      writer.Save(simulation, simulation_time, elapsed_time, path);
+      // Moments up to a checkpoint survive a crash after it.
+      if (moments_writer != nullptr) {
+        moments_writer->Flush();
+      }
+      if (kProfilingEnabled) {
+        simulation.GetProfile().WriteJson(simulation_time, profile_out);
+      }
     }
   }
   auto end_time = high_resolution_clock::now();
+  writer.Close();
 
   return end_time - start_time;
 }
 
 
-std::unique_ptr<Simulation> ConstructSimulation(const SimulationConfiguration& config) {
-  std::unique_ptr<Simulation> sim;    
-  switch (config.kernel_type()) {
-    case SimulationConfiguration::UNKNOWN :
-      std::cerr << "Kernel unknown" << std::endl;
-      exit(1);
-      break;
-    case SimulationConfiguration::CONSTANT :
-      sim = std::make_unique<ConstantKernelSimulation>(config.fragmentation_rate(), std::mt19937());
-      break;
-    case SimulationConfiguration::BALLISTIC :
-      sim = std::make_unique<BallisticKernelSimulation>(config.fragmentation_rate(), std::mt19937());
-      break;
-    case SimulationConfiguration::MULTIPLICATION :
-      break;
-    case SimulationConfiguration::BROWNIAN :
-      sim = std::make_unique<BrownianKernelSimulation>(config.fragmentation_rate(), std::mt19937(),
-          config.brownian_kernel_params().alpha());
-      break;
+std::unique_ptr<Simulation> ConstructSimulation(const SimulationConfiguration& config,
+                                                double* simulation_time,
+                                                nanoseconds* elapsed_time,
+                                                RandomEngine rng,
+                                                std::shared_ptr<KernelTable> kernel_table = nullptr) {
+  std::unique_ptr<Simulation> sim = ConstructEmptySimulation(config, rng);
+  if (kernel_table != nullptr) {
+    sim->ShareKernelTable(kernel_table);
   }
+  *simulation_time = 0;
+  *elapsed_time = nanoseconds(0);
 
   if (config.has_load_options()) {
-    LoadCheckpoint(*sim, config.load_options().checkpoint_path());
+    *elapsed_time = LoadCheckpoint(*sim, config.load_options().checkpoint_path(),
+                                   simulation_time);
   } else {
     switch (config.initial_conditions().distribution_type()) {
       case InitialConditions::UNKNOWN :
@@ -72,12 +109,11 @@ std::unique_ptr<Simulation> ConstructSimulation(const SimulationConfiguration& c
           exit(1); 
         }
         
-        sim->AddMonomers(num_particles_per_size);
-        for (long long size = 2; size <= num_sizes; ++size) {
-            for (long long num_part = 0; num_part < num_particles_per_size; ++num_part) {
-              sim->AddParticle(size);
-            }
+        std::vector<Particle> particles;
+        for (long long size = 1; size <= num_sizes; ++size) {
+          particles.push_back(Particle{num_particles_per_size, size, 0});
         }
+        sim->AddParticles(particles);
         break;         
     }
   }
@@ -86,6 +122,88 @@ std::unique_ptr<Simulation> ConstructSimulation(const SimulationConfiguration& c
 
 
 
+// Observables of ensemble.h for the targets of `options`, all of them if
+// none are listed.
+std::vector<int> TargetObservables(const EnsembleOptions& options) {
+  std::vector<int> observables;
+  for (int target : options.target_observables()) {
+    switch (target) {
+      case EnsembleOptions::ZEROTH_MOMENT :
+        observables.push_back(kZerothMoment);
+        break;
+      case EnsembleOptions::SECOND_MOMENT :
+        observables.push_back(kSecondMoment);
+        break;
+      case EnsembleOptions::MONOMER_FRACTION :
+        observables.push_back(kMonomerFraction);
+        break;
+    }
+  }
+  if (observables.empty()) {
+    observables = {kZerothMoment, kSecondMoment, kMonomerFraction};
+  }
+  return observables;
+}
+
+
+// Runs the replicas of the ensemble options on a thread pool, where every
+// thread takes the next replica until none are left or the target error is
+// met, and writes their statistics at every checkpoint time. Replicas run
+// single-threaded and share one kernel table, built before they start.
+void RunEnsemble(SimulationConfiguration config) {
+  config.set_num_threads(1);
+  std::shared_ptr<KernelTable> kernel_table =
+      ConstructEmptySimulation(config)->BuiltKernelTable();
+  const EnsembleOptions& options = config.ensemble_options();
+  const SaveOptions& save_options = config.save_options();
+  int spectrum_sizes = options.spectrum_sizes() > 0 ? options.spectrum_sizes() : 100;
+  double interval = save_options.checkpoint_interval();
+  int num_checkpoints = int(config.duration() / interval) + 1;
+  EnsembleStatistics statistics(num_checkpoints, spectrum_sizes);
+  std::vector<int> targets = TargetObservables(options);
+  int min_replicas = options.min_replicas() > 0 ? options.min_replicas() : 10;
+
+  std::atomic<int> next_replica(0);
+  std::atomic<bool> target_met(false);
+  ThreadPool pool(std::max(options.num_threads(), 1));
+  pool.Run([&](int thread) {
+    for (int replica = next_replica++; replica < options.num_replicas() && !target_met;
+         replica = next_replica++) {
+      double simulation_time;
+      nanoseconds elapsed_time;
+      std::unique_ptr<Simulation> simulation = ConstructSimulation(
+          config, &simulation_time, &elapsed_time,
+          ConstructRandomEngine(config, options.seed(), replica), kernel_table);
+      int checkpoint = 0;
+      while (true) {
+        while (checkpoint < num_checkpoints && simulation_time >= checkpoint * interval) {
+          statistics.Add(checkpoint, Observe(*simulation, spectrum_sizes));
+          checkpoint++;
+        }
+        if (simulation_time >= config.duration()) {
+          break;
+        }
+        simulation_time += simulation->RunSimulationStep();
+      }
+      std::cout << "Replica " + std::to_string(replica) + " finished\n";
+
+      if (options.target_relative_error() > 0 &&
+          statistics.NumReplicas(num_checkpoints - 1) >= min_replicas &&
+          statistics.MaxRelativeError(targets) <= options.target_relative_error()) {
+        target_met = true;
+      }
+    }
+  });
+  std::cout << "Finished " << statistics.NumReplicas(num_checkpoints - 1)
+            << " replicas, largest relative standard error "
+            << statistics.MaxRelativeError(targets) << std::endl;
+
+  std::filesystem::create_directories(save_options.output_dir());
+  std::ofstream out(save_options.output_dir() + "/ensemble.jsonl");
+  statistics.WriteJson(interval, out);
+}
+
+
 int main(int argc, char const *argv[]) {
   if (argc != 2) {
     std::cerr << "Please specify a path to a config and no other arguments." << std::endl;
@@ -96,9 +214,25 @@ int main(int argc, char const *argv[]) {
   SimulationConfiguration config;
   JsonStringToMessage(GetFileContents(input), &config);
 
+  if (config.has_ensemble_options()) {
+    if (config.has_load_options()) {
+      std::cerr << "Ensembles cannot be loaded from a checkpoint." << std::endl;
+      exit(1);
+    }
+    RunEnsemble(config);
+    return 0;
+  }
+
 
 
-  std::unique_ptr<Simulation> simulation = ConstructSimulation(config);
-  RunSimulation(*simulation, config.duration(), config.save_options());
+  double simulation_time;
+  nanoseconds elapsed_time;
+  std::unique_ptr<Simulation> simulation = ConstructSimulation(
+      config, &simulation_time, &elapsed_time, ConstructRandomEngine(config, config.seed()));
+  if (simulation->KernelTableBytes() > 0) {
+    std::cout << "Kernel table: " << simulation->KernelTableBytes() / (1 << 20) << " MiB\n";
+  }
+  RunSimulation(*simulation, config.duration(), config.save_options(), simulation_time,
+                elapsed_time);
   return 0;
 }
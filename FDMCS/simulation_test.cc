@@ -9,6 +9,7 @@ using ::testing::UnorderedElementsAre;
 using ::testing::AnyOf;
 
 #include <iostream>
+#include <limits>
 
 inline bool operator==(const Particle& lhs, const Particle& rhs) {
   return lhs.size == rhs.size && lhs.count == rhs.count &&
@@ -32,13 +33,14 @@ int CountParticles(const std::vector<Particle>& particles) {
 }
 
 
-class TestSimulation : public Simulation {
-  using Simulation::Simulation;
-  inline double CollisionFunction(long long first_size, long long second_size) override {
+struct TestKernel : KernelDefaults<TestKernel> {
+  inline double operator()(double first_size, double second_size) const {
     return first_size * second_size;
   }
 };
 
+using TestSimulation = KernelSimulation<TestKernel>;
+
 
 TEST(SimulationTest, AddParticleWorks) {
   TestSimulation simulation;
@@ -68,6 +70,30 @@ TEST(SimulationTest, AddParticleWorks) {
                   Particle{/*count=*/1, /*size=*/10000, /*rate=*/40000}));
 }
 
+TEST(SimulationTest, AddParticlesMatchesAddParticle) {
+  TestSimulation batched;
+  TestSimulation single;
+  batched.AddParticle(2);
+  single.AddParticle(2);
+
+  batched.AddParticles(3, 4);
+  batched.AddParticles({Particle{/*count=*/2, /*size=*/1, /*rate=*/0},
+                        Particle{/*count=*/3, /*size=*/2, /*rate=*/0},
+                        Particle{/*count=*/2, /*size=*/10000, /*rate=*/0}});
+  for (auto [size, count] : std::vector<std::pair<int, int>>{{3, 4}, {1, 2}, {2, 3}, {10000, 2}}) {
+    for (int i = 0; i < count; i++) {
+      single.AddParticle(size);
+    }
+  }
+
+  EXPECT_THAT(batched.GetDistribution(), UnorderedElementsAre(
+                             Particle{/*count=*/2, /*size=*/1, /*rate=*/20021},
+                             Particle{/*count=*/4, /*size=*/2, /*rate=*/40040},
+                             Particle{/*count=*/4, /*size=*/3, /*rate=*/60057},
+                             Particle{/*count=*/2, /*size=*/10000, /*rate=*/100220000}));
+  EXPECT_EQ(batched.GetDistribution(), single.GetDistribution());
+}
+
 TEST(SimulationTest, FindPairWorks) {
   TestSimulation simulation;
   simulation.AddParticle(1);
@@ -143,7 +169,7 @@ TEST(SimulationTest, DeleteParticleWorks) {
                   Particle{/*count=*/1, /*size=*/1, /*rate=*/10000},
                   Particle{/*count=*/1, /*size=*/10000, /*rate=*/10000}));
 
-  simulation.DeleteParticle(1000);
+  simulation.DeleteParticle(kNumSmallParticles);
   particles = simulation.GetDistribution();
   EXPECT_THAT(particles, UnorderedElementsAre(
                              Particle{/*count=*/1, /*size=*/1, /*rate=*/0}));
@@ -249,6 +275,512 @@ TEST(SimulationTest, DuplicateParticles) {
   EXPECT_THAT(particles, UnorderedElementsAre(
                              Particle{/*count=*/4, /*size=*/1, /*rate=*/20007},
                              Particle{/*count=*/2, /*size=*/2, /*rate=*/40012},
-                             Particle{/*count=*/1, /*size=*/10000, /*rate=*/100 * 1000 * 1000 + 80 * 1000},
-                             Particle{/*count=*/1, /*size=*/10000, /*rate=*/100 * 1000 * 1000 + 80 * 1000}));
+                             Particle{/*count=*/2, /*size=*/10000, /*rate=*/100 * 1000 * 1000 + 80 * 1000}));
+}
+
+TEST(KernelTest, FeaturesMatchDirectEvaluation) {
+  BallisticKernel ballistic;
+  BrownianKernel brownian(/*alpha=*/0.7);
+  for (double first : {1.0, 3.0, 250.0, 12345.0}) {
+    for (double second : {1.0, 7.0, 9999.0, 1e7}) {
+      double expected = ballistic(first, second);
+      EXPECT_NEAR(ballistic.FromFeatures(ballistic.Features(first), ballistic.Features(second)),
+                  expected, 1e-12 * expected);
+      expected = brownian(first, second);
+      EXPECT_NEAR(brownian.FromFeatures(brownian.Features(first), brownian.Features(second)),
+                  expected, 1e-12 * expected);
+    }
+  }
+}
+
+// Relative error of the total rate summed by the rate-update loops against
+// a direct evaluation of the kernel over all pairs.
+template <typename Kernel>
+double TotalRateError(Kernel kernel) {
+  KernelSimulation<Kernel> simulation(/*fragmentation_rate=*/0, std::mt19937(), kernel);
+  std::vector<Particle> particles;
+  for (int size = 1; size < 3000; size += 7) {
+    particles.push_back(Particle{size % 13 + 1, size, 0});
+  }
+  particles.push_back(Particle{3, 20000, 0});
+  particles.push_back(Particle{1, 1234567, 0});
+  simulation.AddParticles(particles);
+
+  long double expected = 0;
+  for (const auto& first : particles) {
+    for (const auto& second : particles) {
+      long double pairs = (long double) first.count * (second.count - (&first == &second));
+      expected += pairs * kernel(first.size, second.size);
+    }
+  }
+  long double actual = 0;
+  for (const auto& particle : simulation.GetDistribution()) {
+    actual += (long double) particle.count * particle.collision_rate;
+  }
+  return std::abs((double) ((actual - expected) / expected));
+}
+
+TEST(KernelTest, TotalRateErrorIsBounded) {
+  EXPECT_LT(TotalRateError(ConstantKernel()), 1e-13);
+  EXPECT_LT(TotalRateError(MultiplicationKernel()), 1e-13);
+  EXPECT_LT(TotalRateError(BallisticKernel()), 1e-13);
+  EXPECT_LT(TotalRateError(BrownianKernel(/*alpha=*/0.7)), 1e-13);
+}
+
+// Collision rates are updated incrementally and never recounted. Every
+// update rounds once, so after n updates the relative error of a rate is at
+// most n * epsilon.
+TEST(SimulationTest, RateDriftIsBoundedOverTenMillionUpdates) {
+  BrownianKernelSimulation simulation(/*fragmentation_rate=*/0, std::mt19937(), /*alpha=*/0.5);
+  constexpr int kNumSizes = 20;
+  constexpr int kNumUpdates = 10'000'000;
+  for (int size = 1; size <= kNumSizes; size++) {
+    simulation.AddParticles(size, 1000);
+  }
+  for (int i = 0; i < kNumUpdates / 2; i++) {
+    int size = i % kNumSizes + 1;
+    simulation.AddParticle(size);
+    simulation.DeleteParticle(size);
+  }
+
+  double bound = kNumUpdates * std::numeric_limits<double>::epsilon();
+  for (const auto& particle : simulation.GetDistribution()) {
+    double expected = -simulation.CollisionFunction(particle.size, particle.size);
+    for (int size = 1; size <= kNumSizes; size++) {
+      expected += 1000 * simulation.CollisionFunction(particle.size, size);
+    }
+    EXPECT_NEAR(particle.collision_rate, expected, bound * expected);
+  }
+}
+
+// Moments normalized by the total mass, which makes them independent of
+// particle duplication.
+std::pair<double, double> NormalizedMoments(Simulation& simulation, double duration) {
+  double time = 0;
+  while (time < duration) {
+    time += simulation.RunSimulationStep();
+  }
+  double zeroth = 0;
+  double first = 0;
+  double second = 0;
+  for (const auto& particle : simulation.GetDistribution()) {
+    zeroth += particle.count;
+    first += particle.count * particle.size;
+    second += particle.count * particle.size * (double) particle.size;
+  }
+  return std::pair{zeroth / first, second / first};
+}
+
+std::pair<double, double> AverageMoments(PairSelection pair_selection,
+                                         FirstSampler first_sampler = FirstSampler::kSumTree,
+                                         SecondSampler second_sampler = SecondSampler::kScan,
+                                         RngEngine engine = RngEngine::kMt19937) {
+  const int num_runs = 64;
+  double zeroth = 0;
+  double second = 0;
+  for (int seed = 0; seed < num_runs; seed++) {
+    BrownianKernelSimulation simulation(/*fragmentation_rate=*/0.1, RandomEngine(engine, seed),
+                                        /*alpha=*/0.5);
+    simulation.SetPairSelection(pair_selection);
+    simulation.SetFirstSampler(first_sampler);
+    simulation.SetSecondSampler(second_sampler);
+    simulation.AddMonomers(2000);
+    auto moments = NormalizedMoments(simulation, /*duration=*/5.0);
+    zeroth += moments.first / num_runs;
+    second += moments.second / num_runs;
+  }
+  return std::pair{zeroth, second};
+}
+
+TEST(SimulationTest, MajorantMatchesExactMoments) {
+  auto exact = AverageMoments(PairSelection::kExact);
+  auto majorant = AverageMoments(PairSelection::kMajorant);
+
+  EXPECT_NEAR(majorant.first, exact.first, 0.03 * exact.first);
+  EXPECT_NEAR(majorant.second, exact.second, 0.03 * exact.second);
+}
+
+TEST(SimulationTest, RateClassesMatchSumTreeMoments) {
+  auto sum_tree = AverageMoments(PairSelection::kExact);
+  auto rate_classes = AverageMoments(PairSelection::kExact, FirstSampler::kRateClasses);
+
+  EXPECT_NEAR(rate_classes.first, sum_tree.first, 0.03 * sum_tree.first);
+  EXPECT_NEAR(rate_classes.second, sum_tree.second, 0.03 * sum_tree.second);
+}
+
+TEST(SimulationTest, SizeClassPartnersMatchScanMoments) {
+  auto scan = AverageMoments(PairSelection::kExact);
+  auto size_classes = AverageMoments(PairSelection::kExact, FirstSampler::kSumTree,
+                                     SecondSampler::kSizeClasses);
+
+  EXPECT_NEAR(size_classes.first, scan.first, 0.03 * scan.first);
+  EXPECT_NEAR(size_classes.second, scan.second, 0.03 * scan.second);
+}
+
+TEST(SimulationTest, LowRankMatchesExactMoments) {
+  auto exact = AverageMoments(PairSelection::kExact);
+  auto low_rank = AverageMoments(PairSelection::kLowRank);
+
+  EXPECT_NEAR(low_rank.first, exact.first, 0.03 * exact.first);
+  EXPECT_NEAR(low_rank.second, exact.second, 0.03 * exact.second);
+}
+
+TEST(SimulationTest, LowRankMatchesExactRates) {
+  BrownianKernelSimulation exact(/*fragmentation_rate=*/0, std::mt19937(), /*alpha=*/0.5);
+  BrownianKernelSimulation low_rank(/*fragmentation_rate=*/0, std::mt19937(), /*alpha=*/0.5);
+  low_rank.SetPairSelection(PairSelection::kLowRank);
+  for (Simulation* simulation : {(Simulation*) &exact, (Simulation*) &low_rank}) {
+    simulation->AddMonomers(3);
+    simulation->AddParticle(2);
+    simulation->AddParticle(5);
+    simulation->AddParticle(12000);
+    simulation->AddParticle(15000);
+    simulation->DeleteParticle(kNumSmallParticles);
+  }
+
+  EXPECT_EQ(low_rank.GetDistribution(), exact.GetDistribution());
+}
+
+TEST(SimulationTest, LowRankMatchesExactRatesAfterDuplication) {
+  BrownianKernelSimulation exact(/*fragmentation_rate=*/0, std::mt19937(), /*alpha=*/0.5);
+  BrownianKernelSimulation low_rank(/*fragmentation_rate=*/0, std::mt19937(), /*alpha=*/0.5);
+  low_rank.SetPairSelection(PairSelection::kLowRank);
+  for (Simulation* simulation : {(Simulation*) &exact, (Simulation*) &low_rank}) {
+    simulation->AddMonomers(3);
+    simulation->AddParticle(5);
+    simulation->AddParticle(12000);
+    simulation->DuplicateParticles();
+  }
+
+  EXPECT_EQ(low_rank.GetDistribution(), exact.GetDistribution());
+}
+
+TEST(SimulationTest, RestoreStateContinuesExactly) {
+  for (PairSelection pair_selection :
+       {PairSelection::kExact, PairSelection::kMajorant, PairSelection::kLowRank}) {
+    BrownianKernelSimulation original(/*fragmentation_rate=*/0.3, std::mt19937(), /*alpha=*/0.5);
+    original.SetPairSelection(pair_selection);
+    original.AddMonomers(300);
+    original.AddParticle(12000);
+    original.AddParticle(15000);
+    for (int i = 0; i < 150; i++) {
+      original.RunSimulationStep();
+    }
+
+    SimulationState state;
+    original.SaveState(&state);
+    BrownianKernelSimulation restored(/*fragmentation_rate=*/0, std::mt19937(), /*alpha=*/0.5);
+    restored.RestoreState(state);
+
+    for (int i = 0; i < 300; i++) {
+      ASSERT_EQ(restored.RunSimulationStep(), original.RunSimulationStep());
+    }
+    std::vector<Particle> expected = original.GetDistribution();
+    std::vector<Particle> actual = restored.GetDistribution();
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+      EXPECT_EQ(actual[i].count, expected[i].count);
+      EXPECT_EQ(actual[i].size, expected[i].size);
+      EXPECT_EQ(actual[i].collision_rate, expected[i].collision_rate);
+    }
+  }
+}
+
+TEST(SimulationTest, BigParticlesOfEqualSizeShareAGroup) {
+  TestSimulation simulation;
+  simulation.AddParticle(1);
+  simulation.AddParticle(12000);
+  simulation.AddParticle(15000);
+  simulation.AddParticles(12000, 2);
+  EXPECT_THAT(simulation.GetDistribution(), UnorderedElementsAre(
+                  Particle{/*count=*/1, /*size=*/1, /*rate=*/12000 * 3 + 15000},
+                  Particle{/*count=*/3, /*size=*/12000, /*rate=*/12000 + 12000 * 12000 * 2 + 12000 * 15000},
+                  Particle{/*count=*/1, /*size=*/15000, /*rate=*/15000 + 15000 * 12000 * 3}));
+
+  // Emptying the first big group moves the last one into its slot.
+  for (int i = 0; i < 3; i++) {
+    simulation.DeleteParticle(kNumSmallParticles);
+  }
+  simulation.AddParticle(15000);
+  EXPECT_THAT(simulation.GetDistribution(), UnorderedElementsAre(
+                  Particle{/*count=*/1, /*size=*/1, /*rate=*/15000 * 2},
+                  Particle{/*count=*/2, /*size=*/15000, /*rate=*/15000 + 15000 * 15000}));
+}
+
+TEST(SimulationTest, TotalSizeShrinksWhenLargestGroupEmpties) {
+  BrownianKernelSimulation simulation(/*fragmentation_rate=*/0, std::mt19937(), /*alpha=*/0.5);
+  simulation.AddMonomers(3);
+  simulation.AddParticle(700);
+  simulation.AddParticle(12000);
+  SimulationState state;
+  simulation.SaveState(&state);
+  EXPECT_EQ(state.total_size, kNumSmallParticles + 1);
+
+  simulation.DeleteParticle(kNumSmallParticles);
+  simulation.SaveState(&state);
+  EXPECT_EQ(state.total_size, 701);
+
+  simulation.DeleteParticle(700);
+  simulation.SaveState(&state);
+  EXPECT_EQ(state.total_size, 2);
+  EXPECT_EQ(state.small_groups.Size(), 2);
+  EXPECT_NEAR(state.total_rate, 3 * 2 * simulation.CollisionFunction(1, 1), 1e-9);
+}
+
+TEST(SimulationTest, EnginesMatchMoments) {
+  auto reference = AverageMoments(PairSelection::kExact);
+  for (RngEngine engine :
+       {RngEngine::kXoshiro256PlusPlus, RngEngine::kPcg64, RngEngine::kPhilox4x32}) {
+    auto moments = AverageMoments(PairSelection::kExact, FirstSampler::kSumTree,
+                                  SecondSampler::kScan, engine);
+    EXPECT_NEAR(moments.first, reference.first, 0.03 * reference.first);
+    EXPECT_NEAR(moments.second, reference.second, 0.03 * reference.second);
+  }
+}
+
+TEST(SimulationTest, RestoreStateContinuesExactlyWithEveryEngine) {
+  for (RngEngine engine :
+       {RngEngine::kXoshiro256PlusPlus, RngEngine::kPcg64, RngEngine::kPhilox4x32}) {
+    BrownianKernelSimulation original(/*fragmentation_rate=*/0.3,
+                                      RandomEngine(engine, /*seed=*/5, /*stream=*/2),
+                                      /*alpha=*/0.5);
+    original.AddMonomers(300);
+    for (int i = 0; i < 151; i++) {
+      original.RunSimulationStep();
+    }
+
+    SimulationState state;
+    original.SaveState(&state);
+    BrownianKernelSimulation restored(/*fragmentation_rate=*/0, std::mt19937(), /*alpha=*/0.5);
+    restored.RestoreState(state);
+
+    for (int i = 0; i < 300; i++) {
+      ASSERT_EQ(restored.RunSimulationStep(), original.RunSimulationStep());
+    }
+    EXPECT_EQ(restored.GetDistribution(), original.GetDistribution());
+  }
+}
+
+TEST(SimulationTest, RestoreStateContinuesExactlyWithSizeClassPartners) {
+  BrownianKernelSimulation original(/*fragmentation_rate=*/0.3, std::mt19937(), /*alpha=*/0.5);
+  original.SetSecondSampler(SecondSampler::kSizeClasses);
+  original.AddMonomers(300);
+  original.AddParticle(12000);
+  original.AddParticle(15000);
+  for (int i = 0; i < 150; i++) {
+    original.RunSimulationStep();
+  }
+
+  SimulationState state;
+  original.SaveState(&state);
+  BrownianKernelSimulation restored(/*fragmentation_rate=*/0, std::mt19937(), /*alpha=*/0.5);
+  restored.SetSecondSampler(SecondSampler::kSizeClasses);
+  restored.RestoreState(state);
+
+  for (int i = 0; i < 300; i++) {
+    ASSERT_EQ(restored.RunSimulationStep(), original.RunSimulationStep());
+  }
+  EXPECT_EQ(restored.GetDistribution(), original.GetDistribution());
+}
+
+void ExpectMomentsOfDistribution(Simulation& simulation) {
+  Moments expected{0, 0, 0.0};
+  for (const auto& particle : simulation.GetDistribution()) {
+    expected.zeroth += particle.count;
+    expected.first += particle.count * particle.size;
+    expected.second += particle.count * (double) particle.size * particle.size;
+  }
+  Moments moments = simulation.GetMoments();
+  EXPECT_EQ(moments.zeroth, expected.zeroth);
+  EXPECT_EQ(moments.first, expected.first);
+  EXPECT_EQ(moments.second, expected.second);
+}
+
+TEST(SimulationTest, MomentsTrackTheDistribution) {
+  for (PairSelection pair_selection :
+       {PairSelection::kExact, PairSelection::kMajorant, PairSelection::kLowRank}) {
+    BrownianKernelSimulation simulation(/*fragmentation_rate=*/0.3, std::mt19937(),
+                                        /*alpha=*/0.5);
+    simulation.SetPairSelection(pair_selection);
+    simulation.AddMonomers(300);
+    simulation.AddParticles(/*size=*/20000, /*count=*/3);
+    ExpectMomentsOfDistribution(simulation);
+    for (int i = 0; i < 2000; i++) {
+      simulation.RunSimulationStep();
+      if (i == 1000) {
+        simulation.DuplicateParticles();
+      }
+      if (i % 100 == 0) {
+        ExpectMomentsOfDistribution(simulation);
+      }
+    }
+    EXPECT_EQ(simulation.CheckConsistency(ValidationLevel::kFull), "");
+
+    SimulationState state;
+    simulation.SaveState(&state);
+    BrownianKernelSimulation restored(/*fragmentation_rate=*/0, std::mt19937(), /*alpha=*/0.5);
+    restored.RestoreState(state);
+    Moments moments = restored.GetMoments();
+    EXPECT_EQ(moments.zeroth, simulation.GetMoments().zeroth);
+    EXPECT_EQ(moments.first, simulation.GetMoments().first);
+    EXPECT_EQ(moments.second, simulation.GetMoments().second);
+  }
+}
+
+TEST(SimulationTest, KernelTableMatchesDirectEvaluation) {
+  BrownianKernelSimulation direct(/*fragmentation_rate=*/0.3, std::mt19937(), /*alpha=*/0.5);
+  BrownianKernelSimulation tabulated(/*fragmentation_rate=*/0.3, std::mt19937(), /*alpha=*/0.5);
+  tabulated.SetKernelTableCutoff(/*cutoff=*/500);
+  EXPECT_EQ(tabulated.KernelTableBytes(), 500 * 501 / 2 * sizeof(double));
+  for (long long first : {1, 2, 17, 499, 500, 12000}) {
+    for (long long second : {1, 3, 499, 12000}) {
+      ASSERT_EQ(tabulated.CollisionFunction(first, second), direct.CollisionFunction(first, second));
+    }
+  }
+
+  for (BrownianKernelSimulation* simulation : {&direct, &tabulated}) {
+    simulation->SetSecondSampler(SecondSampler::kSizeClasses);
+    simulation->AddMonomers(300);
+    simulation->AddParticle(12000);
+  }
+  for (int i = 0; i < 300; i++) {
+    ASSERT_EQ(tabulated.RunSimulationStep(), direct.RunSimulationStep());
+  }
+  EXPECT_EQ(tabulated.GetDistribution(), direct.GetDistribution());
+}
+
+TEST(SimulationTest, SharedKernelTableMatchesOwnTable) {
+  BrownianKernelSimulation owner(/*fragmentation_rate=*/0.3, std::mt19937(), /*alpha=*/0.5);
+  owner.SetKernelTableCutoff(/*cutoff=*/500);
+  std::shared_ptr<KernelTable> table = owner.BuiltKernelTable();
+  ASSERT_TRUE(table->Built());
+
+  BrownianKernelSimulation own(/*fragmentation_rate=*/0.3, std::mt19937(), /*alpha=*/0.5);
+  own.SetKernelTableCutoff(/*cutoff=*/500);
+  BrownianKernelSimulation shared(/*fragmentation_rate=*/0.3, std::mt19937(), /*alpha=*/0.5);
+  shared.ShareKernelTable(table);
+  EXPECT_EQ(shared.BuiltKernelTable(), table);
+  EXPECT_EQ(shared.KernelTableBytes(), own.KernelTableBytes());
+
+  for (BrownianKernelSimulation* simulation : {&own, &shared}) {
+    simulation->AddMonomers(300);
+    simulation->AddParticle(12000);
+  }
+  for (int i = 0; i < 300; i++) {
+    ASSERT_EQ(shared.RunSimulationStep(), own.RunSimulationStep());
+  }
+  EXPECT_EQ(shared.GetDistribution(), own.GetDistribution());
+
+  // A new cutoff replaces the table of this simulation only.
+  shared.SetKernelTableCutoff(/*cutoff=*/0);
+  EXPECT_EQ(table->Cutoff(), 500);
+  EXPECT_TRUE(table->Built());
+}
+
+TEST(SimulationTest, FullValidationPassesForAllPairSelections) {
+  for (PairSelection selection : {PairSelection::kExact, PairSelection::kMajorant,
+                                  PairSelection::kLowRank}) {
+    BrownianKernelSimulation simulation(/*fragmentation_rate=*/0.3, std::mt19937(), /*alpha=*/0.5);
+    simulation.SetPairSelection(selection);
+    simulation.SetValidation(ValidationLevel::kFull);
+    simulation.AddMonomers(200);
+    simulation.AddParticle(12000);
+    for (int i = 0; i < 500; i++) {
+      simulation.RunSimulationStep();
+    }
+    EXPECT_EQ(simulation.CheckConsistency(ValidationLevel::kFull), "");
+  }
+}
+
+TEST(SimulationTest, CheckConsistencyFindsCorruptedState) {
+  BrownianKernelSimulation original(/*fragmentation_rate=*/0, std::mt19937(), /*alpha=*/0.5);
+  original.AddMonomers(100);
+  original.AddParticles(3, 10);
+  original.AddParticle(12000);
+  SimulationState state;
+  original.SaveState(&state);
+
+  SimulationState corrupted_rate = state;
+  corrupted_rate.small_groups.collision_rates[3] *= 1.01;
+  BrownianKernelSimulation restored(/*fragmentation_rate=*/0, std::mt19937(), /*alpha=*/0.5);
+  restored.RestoreState(corrupted_rate);
+  EXPECT_THAT(restored.CheckConsistency(ValidationLevel::kFull),
+              ::testing::HasSubstr("collision rate of size 3"));
+  EXPECT_EQ(restored.CheckConsistency(ValidationLevel::kOff), "");
+
+  SimulationState corrupted_count = state;
+  corrupted_count.num_particles += 1;
+  BrownianKernelSimulation miscounted(/*fragmentation_rate=*/0, std::mt19937(), /*alpha=*/0.5);
+  miscounted.RestoreState(corrupted_count);
+  EXPECT_THAT(miscounted.CheckConsistency(ValidationLevel::kSampled),
+              ::testing::HasSubstr("groups hold 111 particles"));
+}
+
+TEST(SimulationTest, ParallelLoopsMatchSerial) {
+  BallisticKernelSimulation serial(/*fragmentation_rate=*/0, std::mt19937());
+  BallisticKernelSimulation parallel(/*fragmentation_rate=*/0, std::mt19937());
+  parallel.SetParallelism(/*num_threads=*/3, /*threshold=*/0);
+  for (Simulation* simulation : {(Simulation*) &serial, (Simulation*) &parallel}) {
+    for (int size = 1; size < 3000; size += 3) {
+      simulation->AddParticles(size, size % 5 + 1);
+    }
+    simulation->AddParticles(12000, 2);
+    simulation->AddParticle(15000);
+    simulation->DeleteParticle(4);
+    simulation->DeleteParticle(kNumSmallParticles);
+  }
+
+  std::vector<Particle> expected = serial.GetDistribution();
+  std::vector<Particle> actual = parallel.GetDistribution();
+  ASSERT_EQ(actual.size(), expected.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    EXPECT_EQ(actual[i].size, expected[i].size);
+    EXPECT_EQ(actual[i].count, expected[i].count);
+    EXPECT_NEAR(actual[i].collision_rate, expected[i].collision_rate,
+                1e-12 * expected[i].collision_rate);
+  }
+
+  // Parts of the parallel search order partners differently, so only the
+  // first particle is compared.
+  std::mt19937 rng;
+  std::uniform_real_distribution<double> rate_dist(0, 1);
+  double total_rate = 0;
+  for (const auto& particle : expected) {
+    total_rate += particle.count * particle.collision_rate;
+  }
+  for (int i = 0; i < 1000; i++) {
+    double rate = rate_dist(rng) * total_rate;
+    std::pair<int, int> pair = parallel.FindPair(rate);
+    EXPECT_EQ(pair.first, serial.FindPair(rate).first);
+    ASSERT_GT(pair.second, 0);
+  }
+}
+
+TEST(SimulationTest, ParallelRunsRepeatExactly) {
+  BrownianKernelSimulation first(/*fragmentation_rate=*/0.3, std::mt19937(), /*alpha=*/0.5);
+  BrownianKernelSimulation second(/*fragmentation_rate=*/0.3, std::mt19937(), /*alpha=*/0.5);
+  for (BrownianKernelSimulation* simulation : {&first, &second}) {
+    simulation->SetParallelism(/*num_threads=*/4, /*threshold=*/64);
+    simulation->SetValidation(ValidationLevel::kSampled, /*interval=*/10);
+    simulation->AddMonomers(500);
+    simulation->AddParticle(12000);
+  }
+  for (int i = 0; i < 500; i++) {
+    ASSERT_EQ(second.RunSimulationStep(), first.RunSimulationStep());
+  }
+  EXPECT_EQ(second.GetDistribution(), first.GetDistribution());
+}
+
+TEST(SimulationTest, MajorantKeepsParticleCount) {
+  TestSimulation simulation;
+  simulation.SetPairSelection(PairSelection::kMajorant);
+  simulation.AddMonomers(50);
+  simulation.AddParticle(3);
+  simulation.AddParticle(20000);
+
+  for (int i = 0; i < 100; i++) {
+    simulation.RunSimulationStep();
+  }
+  std::vector<Particle> particles = simulation.GetDistribution();
+  EXPECT_EQ(CountParticles(particles) % (50 + 3 + 20000), 0);
 }
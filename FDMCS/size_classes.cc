@@ -0,0 +1,92 @@
+#include "size_classes.h"
+
+#include <algorithm>
+
+
+SizeClassIndex::SizeClassIndex(int num_small)
+    : num_small_(num_small), num_classes_(0) {
+  small_tree_.Reserve(num_small);
+  small_counts_.fill(0);
+  big_counts_.fill(0);
+}
+
+
+void SizeClassIndex::AddSmall(long long size, long long count) {
+  int size_class = SizeClass(size);
+  small_counts_[size_class] += count;
+  small_tree_.Update(size, small_tree_.Leaf(size) + count);
+  num_classes_ = std::max(num_classes_, size_class + 1);
+}
+
+
+void SizeClassIndex::RemoveSmall(long long size, long long count) {
+  small_counts_[SizeClass(size)] -= count;
+  small_tree_.Update(size, small_tree_.Leaf(size) - count);
+}
+
+
+void SizeClassIndex::AddBig(long long size, long long count) {
+  int size_class = SizeClass(size);
+  int position = big_members_[size_class].size();
+  big_class_.push_back(size_class);
+  big_position_.push_back(position);
+  big_slot_counts_.push_back(count);
+  big_members_[size_class].push_back(big_class_.size() - 1);
+  big_trees_[size_class].Reserve(position + 1);
+  big_trees_[size_class].Update(position, count);
+  big_counts_[size_class] += count;
+  num_classes_ = std::max(num_classes_, size_class + 1);
+}
+
+
+void SizeClassIndex::AddBigCount(int slot, long long delta) {
+  int size_class = big_class_[slot];
+  big_slot_counts_[slot] += delta;
+  big_trees_[size_class].Update(big_position_[slot], big_slot_counts_[slot]);
+  big_counts_[size_class] += delta;
+}
+
+
+void SizeClassIndex::RemoveBig(int slot) {
+  int size_class = big_class_[slot];
+  std::vector<int>& members = big_members_[size_class];
+  int moved = members.back();
+  members[big_position_[slot]] = moved;
+  big_position_[moved] = big_position_[slot];
+  members.pop_back();
+  big_trees_[size_class].Update(big_position_[slot], big_slot_counts_[moved]);
+  big_trees_[size_class].Update(members.size(), 0);
+  big_counts_[size_class] -= big_slot_counts_[slot];
+
+  int last = big_class_.size() - 1;
+  if (slot != last) {
+    big_class_[slot] = big_class_[last];
+    big_position_[slot] = big_position_[last];
+    big_slot_counts_[slot] = big_slot_counts_[last];
+    big_members_[big_class_[slot]][big_position_[slot]] = slot;
+  }
+  big_class_.pop_back();
+  big_position_.pop_back();
+  big_slot_counts_.pop_back();
+}
+
+
+void SizeClassIndex::RestoreBigPositions(const std::vector<int>& positions) {
+  for (size_t slot = 0; slot < positions.size(); slot++) {
+    big_position_[slot] = positions[slot];
+    big_members_[big_class_[slot]][positions[slot]] = slot;
+    big_trees_[big_class_[slot]].Update(positions[slot], big_slot_counts_[slot]);
+  }
+}
+
+
+int SizeClassIndex::Sample(int size_class, double uniform) const {
+  double target = uniform * Count(size_class);
+  if (target < small_counts_[size_class]) {
+    double rate = small_tree_.Prefix(SizeClassMin(size_class)) + target;
+    return small_tree_.Find(&rate);
+  }
+  double rate = target - small_counts_[size_class];
+  int position = big_trees_[size_class].Find(&rate);
+  return num_small_ + big_members_[size_class][position];
+}
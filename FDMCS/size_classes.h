@@ -0,0 +1,81 @@
+#ifndef FDMCS_SIZE_CLASSES
+#define FDMCS_SIZE_CLASSES
+
+#include <array>
+#include <vector>
+
+#include "rate_tree.h"
+
+inline constexpr int kNumSizeClasses = 64;
+
+// Logarithmic size class of a particle: sizes in [2^c, 2^(c+1)) belong to
+// class c.
+inline int SizeClass(long long size) {
+  return 63 - __builtin_clzll(size);
+}
+
+inline long long SizeClassMin(int size_class) {
+  return 1LL << size_class;
+}
+
+inline long long SizeClassMax(int size_class) {
+  return (SizeClassMin(size_class) - 1) * 2 + 1;
+}
+
+// Tracks how many particles fall into every size class and draws a uniformly
+// random particle from a given class.
+//
+// Particles are addressed with the same indices as in Simulation: small
+// particles by their size, big particles by `num_small + slot`, where slot is
+// the position of their group inside of the big particle storage. Removal of
+// a big group mirrors the swap-with-last removal done by the storage.
+class SizeClassIndex {
+ public:
+  explicit SizeClassIndex(int num_small);
+
+  void AddSmall(long long size, long long count);
+  void RemoveSmall(long long size, long long count);
+  // Appends a big group of `count` particles.
+  void AddBig(long long size, long long count = 1);
+  // Changes the count of an existing big group.
+  void AddBigCount(int slot, long long delta);
+  // Removes a big group, moving the last group into its slot.
+  void RemoveBig(int slot);
+
+  // Position of a big group inside of its class, which depends on the order
+  // of past removals.
+  inline int BigPosition(int slot) const { return big_position_[slot]; }
+  // Reorders the members of every class to the given positions, one per big
+  // slot. Used to restore saved states after all big particles are added.
+  void RestoreBigPositions(const std::vector<int>& positions);
+
+  inline long long Count(int size_class) const {
+    return small_counts_[size_class] + big_counts_[size_class];
+  }
+
+  // One past the largest class that has ever been populated.
+  inline int NumClasses() const { return num_classes_; }
+
+  // Returns the index of a uniformly chosen particle of `size_class`, given a
+  // uniform random number in [0, 1).
+  int Sample(int size_class, double uniform) const;
+
+ private:
+  int num_small_;
+  int num_classes_;
+  // Particle counts of small sizes, used to pick a size within a class.
+  RateTree small_tree_;
+  std::array<long long, kNumSizeClasses> small_counts_;
+  // Slots of big groups belonging to each class.
+  std::array<std::vector<int>, kNumSizeClasses> big_members_;
+  // Particle counts of the members of each class, indexed by position, used
+  // to pick a group within a class.
+  std::array<RateTree, kNumSizeClasses> big_trees_;
+  std::array<long long, kNumSizeClasses> big_counts_;
+  // Class, position inside of big_members_ and count for every big slot.
+  std::vector<int> big_class_;
+  std::vector<int> big_position_;
+  std::vector<long long> big_slot_counts_;
+};
+
+#endif
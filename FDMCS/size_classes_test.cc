@@ -0,0 +1,77 @@
+#include "size_classes.h"
+
+#include "gtest/gtest.h"
+
+
+TEST(SizeClassTest, ClassBoundaries) {
+  EXPECT_EQ(SizeClass(1), 0);
+  EXPECT_EQ(SizeClass(2), 1);
+  EXPECT_EQ(SizeClass(3), 1);
+  EXPECT_EQ(SizeClass(4), 2);
+  EXPECT_EQ(SizeClass(10000), 13);
+  EXPECT_EQ(SizeClassMin(3), 8);
+  EXPECT_EQ(SizeClassMax(3), 15);
+}
+
+TEST(SizeClassIndexTest, CountsSmallAndBig) {
+  SizeClassIndex index(/*num_small=*/16);
+  index.AddSmall(1, 5);
+  index.AddSmall(9, 2);
+  index.AddBig(20);
+  index.AddBig(30);
+  index.AddBig(40);
+
+  EXPECT_EQ(index.Count(0), 5);
+  EXPECT_EQ(index.Count(3), 2);
+  EXPECT_EQ(index.Count(4), 2);
+  EXPECT_EQ(index.Count(5), 1);
+  EXPECT_EQ(index.NumClasses(), 6);
+
+  index.RemoveSmall(1, 3);
+  EXPECT_EQ(index.Count(0), 2);
+}
+
+TEST(SizeClassIndexTest, SampleStaysInClass) {
+  SizeClassIndex index(/*num_small=*/16);
+  index.AddSmall(8, 1);
+  index.AddSmall(12, 3);
+  index.AddSmall(2, 1);
+
+  EXPECT_EQ(index.Sample(3, 0.0), 8);
+  EXPECT_EQ(index.Sample(3, 0.3), 12);
+  EXPECT_EQ(index.Sample(3, 0.99), 12);
+  EXPECT_EQ(index.Sample(1, 0.5), 2);
+}
+
+TEST(SizeClassIndexTest, RemoveBigFollowsSwapWithLast) {
+  SizeClassIndex index(/*num_small=*/16);
+  index.AddBig(20);  // slot 0
+  index.AddBig(40);  // slot 1
+  index.AddBig(21);  // slot 2
+
+  // Slot 2 moves into slot 0.
+  index.RemoveBig(0);
+  EXPECT_EQ(index.Count(4), 1);
+  EXPECT_EQ(index.Sample(4, 0.5), 16 + 0);
+  EXPECT_EQ(index.Sample(5, 0.5), 16 + 1);
+}
+
+TEST(SizeClassIndexTest, SampleWeighsBigGroupsByCount) {
+  SizeClassIndex index(/*num_small=*/16);
+  index.AddBig(20, 1);  // slot 0
+  index.AddBig(24, 3);  // slot 1
+  EXPECT_EQ(index.Count(4), 4);
+  EXPECT_EQ(index.Sample(4, 0.2), 16 + 0);
+  EXPECT_EQ(index.Sample(4, 0.3), 16 + 1);
+
+  index.AddBigCount(0, 2);
+  index.AddBigCount(1, -2);
+  EXPECT_EQ(index.Count(4), 4);
+  EXPECT_EQ(index.Sample(4, 0.7), 16 + 0);
+  EXPECT_EQ(index.Sample(4, 0.8), 16 + 1);
+
+  // Slot 1 moves into slot 0 and keeps its count.
+  index.RemoveBig(0);
+  EXPECT_EQ(index.Count(4), 1);
+  EXPECT_EQ(index.Sample(4, 0.5), 16 + 0);
+}
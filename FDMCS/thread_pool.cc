@@ -0,0 +1,75 @@
+#include "thread_pool.h"
+
+
+namespace {
+
+// Polls before a worker goes to sleep. Each poll yields, so that spinning
+// workers do not starve the others when there are fewer cores than threads.
+constexpr int kSpinPolls = 2000;
+
+} // namespace
+
+
+ThreadPool::ThreadPool(int num_threads)
+    : task_(nullptr), generation_(0), pending_(0), stopped_(false) {
+  for (int thread = 1; thread < num_threads; thread++) {
+    workers_.emplace_back(&ThreadPool::Work, this, thread);
+  }
+}
+
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+    generation_++;
+  }
+  started_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+
+void ThreadPool::Run(const std::function<void(int)>& task) {
+  if (workers_.empty()) {
+    task(0);
+    return;
+  }
+  pending_.store(workers_.size(), std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task_ = &task;
+    generation_.fetch_add(1, std::memory_order_release);
+  }
+  started_.notify_all();
+
+  task(0);
+  while (pending_.load(std::memory_order_acquire) > 0) {
+    std::this_thread::yield();
+  }
+}
+
+
+void ThreadPool::Work(int thread) {
+  uint64_t seen = 0;
+  while (true) {
+    uint64_t generation = generation_.load(std::memory_order_acquire);
+    for (int poll = 0; poll < kSpinPolls && generation == seen; poll++) {
+      std::this_thread::yield();
+      generation = generation_.load(std::memory_order_acquire);
+    }
+    if (generation == seen) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      started_.wait(lock, [&] { return generation_.load(std::memory_order_relaxed) != seen; });
+      generation = generation_.load(std::memory_order_relaxed);
+    }
+    // task_ and stopped_ are written before generation_ is incremented.
+    if (stopped_) {
+      return;
+    }
+    seen = generation;
+    (*task_)(thread);
+    pending_.fetch_sub(1, std::memory_order_release);
+  }
+}
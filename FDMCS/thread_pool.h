@@ -0,0 +1,46 @@
+#ifndef FDMCS_THREAD_POOL
+#define FDMCS_THREAD_POOL
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent threads for fork-join loops that take a few microseconds.
+//
+// Run calls `task(t)` once for every t in [0, NumThreads()), with t = 0 on
+// the calling thread, and returns once all calls have finished. Workers
+// spin for a while after a task before they sleep, since the loops of
+// consecutive events follow each other closely. Run must not be called
+// concurrently.
+class ThreadPool {
+ public:
+  // Starts `num_threads - 1` workers.
+  explicit ThreadPool(int num_threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  inline int NumThreads() const { return workers_.size() + 1; }
+
+  void Run(const std::function<void(int)>& task);
+
+ private:
+  void Work(int thread);
+
+  std::vector<std::thread> workers_;
+  const std::function<void(int)>* task_;
+  // Incremented for every task, workers run it once they see a new value.
+  std::atomic<uint64_t> generation_;
+  // Workers that have not finished the current task.
+  std::atomic<int> pending_;
+  bool stopped_;
+  std::mutex mutex_;
+  std::condition_variable started_;
+};
+
+#endif
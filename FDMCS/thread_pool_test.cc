@@ -0,0 +1,24 @@
+#include "thread_pool.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+
+TEST(ThreadPoolTest, RunsEveryThreadOnce) {
+  ThreadPool pool(/*num_threads=*/4);
+  EXPECT_EQ(pool.NumThreads(), 4);
+  std::vector<int> calls(4, 0);
+  for (int i = 0; i < 1000; i++) {
+    pool.Run([&](int thread) { calls[thread]++; });
+  }
+  EXPECT_EQ(calls, std::vector<int>(4, 1000));
+}
+
+TEST(ThreadPoolTest, SingleThreadRunsOnCaller) {
+  ThreadPool pool(/*num_threads=*/1);
+  std::thread::id caller = std::this_thread::get_id();
+  std::thread::id runner;
+  pool.Run([&](int thread) { runner = std::this_thread::get_id(); });
+  EXPECT_EQ(runner, caller);
+}